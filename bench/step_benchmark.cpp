@@ -0,0 +1,183 @@
+#include "Model.h"
+#include "Params.h"
+#include "Scenario.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef PARTICLELIFE_SCENARIO_DIR
+#define PARTICLELIFE_SCENARIO_DIR "scenarios"
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Throughput of Model::step() over the README experiments and synthetic
+// populations, one machine readable line per case:
+//   particlelife_bench [--filter text] [--threads N] [--min-time s] [--max-size N] [--format csv|json] [--list]
+// ns/particle-step and pair evaluations/s use the population and the pairs
+// within the interaction radius averaged over the timed steps. The pairs are
+// counted before every step, out of the timed region.
+
+struct BenchCase {
+    std::string name;
+    Scenario scenario;
+    int size; // Initial population
+};
+
+// Uniform population in a 16:9 world sized for the given mean number of
+// neighbours within the interaction radius, the grid is left to auto_grid
+static BenchCase makeSyntheticCase(const std::string& iPopulation, const std::string& iRegime, int iSize) {
+    float neighbours = iRegime == "dense" ? 30.0f : 4.0f;
+    float radius = ModelConfig().interaction_radius;
+    float area = iSize * M_PI * radius * radius / neighbours;
+    int width = std::max(1, (int)std::sqrt(area*16.0f/9.0f));
+    int height = std::max(1, (int)(area/width));
+    std::ostringstream text;
+    text << "world " << width << " " << height << "\n";
+    if (iPopulation == "mixed") {
+        text << "fill F " << iSize*4/10 << "\n";
+        text << "fill S " << iSize*4/10 << "\n";
+        text << "fill A " << iSize/10 << "\n";
+        text << "fill B " << iSize/20 << "\n";
+        text << "fill L " << iSize - iSize*4/10*2 - iSize/10 - iSize/20 << "\n";
+    } else {
+        text << "fill " << iPopulation << " " << iSize << "\n";
+    }
+    BenchCase benchCase;
+    benchCase.name = iPopulation + "_" + iRegime + "_" + std::to_string(iSize);
+    benchCase.size = iSize;
+    std::istringstream stream(text.str());
+    std::string error;
+    benchCase.scenario.parse(stream, error);
+    return benchCase;
+}
+
+static bool makeScenarioCase(const std::string& iName, const std::string& iFile, BenchCase& oCase) {
+    std::string error;
+    if (!oCase.scenario.load(std::string(PARTICLELIFE_SCENARIO_DIR) + "/" + iFile, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    oCase.name = iName;
+    oCase.size = 0;
+    for (const Scenario::Spawn& spawn : oCase.scenario.spawns)
+        oCase.size += spawn.count;
+    return true;
+}
+
+struct BenchResult {
+    int steps = 0;
+    double seconds = 0.0;
+    double meanPopulation = 0.0;
+    double meanPairs = 0.0;
+    int threads = 1;
+};
+
+// Every case starts from iConfig
+static BenchResult runCase(const BenchCase& iCase, const ModelConfig& iConfig, double iMinTime) {
+    const int warmupSteps = 5;
+    const int minSteps = 3;
+    const int maxSteps = 100000;
+    Model model(iConfig);
+    iCase.scenario.apply(model);
+    for (int i = 0; i < warmupSteps; ++i)
+        model.step();
+
+    BenchResult result;
+    double pairs = 0.0;
+    double population = 0.0;
+    while (result.steps < maxSteps && (result.steps < minSteps || result.seconds < iMinTime)) {
+        population += model.particles.size();
+        pairs += (double)model.countInteractingPairs();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        model.step();
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++result.steps;
+    }
+    result.meanPopulation = population/result.steps;
+    result.meanPairs = pairs/result.steps;
+    result.threads = model.config.nb_threads;
+    return result;
+}
+
+static void printResult(const BenchCase& iCase, const BenchResult& iResult, bool iJson) {
+    double stepsPerSecond = iResult.steps/iResult.seconds;
+    double nsPerParticleStep = iResult.meanPopulation > 0.0 ? 1e9*iResult.seconds/(iResult.steps*iResult.meanPopulation) : 0.0;
+    double pairsPerSecond = iResult.meanPairs*stepsPerSecond;
+    if (iJson) {
+        std::cout << "{\"case\":\"" << iCase.name << "\""
+                  << ",\"particles\":" << iCase.size
+                  << ",\"mean_particles\":" << iResult.meanPopulation
+                  << ",\"threads\":" << iResult.threads
+                  << ",\"steps\":" << iResult.steps
+                  << ",\"seconds\":" << iResult.seconds
+                  << ",\"steps_per_s\":" << stepsPerSecond
+                  << ",\"ns_per_particle_step\":" << nsPerParticleStep
+                  << ",\"pair_evals_per_s\":" << pairsPerSecond << "}" << std::endl;
+    } else {
+        std::cout << iCase.name << "," << iCase.size << "," << iResult.meanPopulation << "," << iResult.threads << ","
+                  << iResult.steps << "," << iResult.seconds << "," << stepsPerSecond << ","
+                  << nsPerParticleStep << "," << pairsPerSecond << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    double minTime = 1.0;
+    int maxSize = 200000;
+    bool json = false;
+    bool list = false;
+    ModelConfig config;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i+1 < argc;
+        if (!std::strcmp(argv[i], "--filter") && hasValue) {
+            filter = argv[++i];
+        } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+            config.nb_threads = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--min-time") && hasValue) {
+            minTime = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--max-size") && hasValue) {
+            maxSize = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--format") && hasValue) {
+            json = !std::strcmp(argv[++i], "json");
+        } else if (!std::strcmp(argv[i], "--list")) {
+            list = true;
+        } else {
+            std::cerr << "usage: particlelife_bench [--filter text] [--threads N] [--min-time s] [--max-size N] [--format csv|json] [--list]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchCase> cases(2);
+    if (!makeScenarioCase("experiment1", "experiment1.txt", cases[0]) ||
+        !makeScenarioCase("experiment2", "experiment2.txt", cases[1]))
+        return 1;
+    const char* populations[] = {"S", "F", "mixed"};
+    const char* regimes[] = {"dense", "sparse"};
+    const int sizes[] = {1000, 10000, 50000, 200000};
+    for (const char* population : populations)
+        for (const char* regime : regimes)
+            for (int size : sizes)
+                if (size <= maxSize)
+                    cases.push_back(makeSyntheticCase(population, regime, size));
+
+    if (!json && !list)
+        std::cout << "case,particles,mean_particles,threads,steps,seconds,steps_per_s,ns_per_particle_step,pair_evals_per_s" << std::endl;
+    for (const BenchCase& benchCase : cases) {
+        if (benchCase.name.find(filter) == std::string::npos)
+            continue;
+        if (list) {
+            std::cout << benchCase.name << std::endl;
+            continue;
+        }
+        BenchResult result = runCase(benchCase, config, minTime);
+        printResult(benchCase, result, json);
+    }
+    return 0;
+}
@@ -1,167 +1,78 @@
 #include "imgui.h"
 #include "imgui-SFML.h"
 #include <SFML/Graphics.hpp>
+#include "Model.h"
+#include "Profiler.h"
+#include "SimulationThread.h"
+#include "Trajectory.h"
 #include <vector>
-#include <list>
 #include <thread>
-#include <random>
 #include <cmath>
 #include <iostream>
-#include <cassert>
 #include <algorithm>
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+#include <cstdio>
+#include <utility>
 
 
-static int K_INIT_PARTICLES = 0;
-static int WORLD_WIDTH = 480;//960;//1920;
-static int WORLD_HEIGTH = 270;//540;//1080;
-static int DOT_SIZE = 2;
-static int K_NB_TYPE = 16;
+// The simulation parameters are in Params.h, the ones below only concern the view
 static sf::Vector2f DOT_OFSET = sf::Vector2f(DOT_SIZE, DOT_SIZE);
 
-static bool g_centerize = false;
 static bool g_draw_s_interaction_radius = false;
-static bool g_destroy_at_boundary = false;
 static bool g_spawn_at_mouse_location= false;
-static bool g_source = false;
-static sf::Vector2f g_source_pos = sf::Vector2f(0, 0);
+static bool g_density_view = true; // Zoomed out, the particles are drawn as a density raster
+static int g_density_cell_pixels = 4; // Below this cell width on screen
 static float g_persistence = 0.5;
 static float s_fps = 0;
-static float g_interaction_radius = 13.0f;//10.0f;
-static float g_temp_speed = 0.2f;
-static float g_dt = 0.1f;
-static int g_ksteps_per_frame = 10;
-static float g_void_viscosity = 0.998;
-static float g_void_torque_viscosity = 0.977;
-static float g_containing_force = 1.0;
-static float g_div_angle = 0.377;
-static float g_s_f_strength = 3.21f;
-static float g_s_t_strength = 0.51f;
-static float g_s_f_exp_power = 3.18f;
-static float g_s_f_viscosity = 1.058f;
-static float g_s_t_viscosity = 1.461;
-static float g_opposition_threshold = 1.426;
-static float g_center_force = 0.0001f;
-
-static int PLUG_NX = 50;
-static int PLUG_NY = 50;
-static float PLUG_DX = (1.*WORLD_WIDTH)/PLUG_NX;
-static float PLUG_DY = (1.*WORLD_HEIGTH)/PLUG_NY;
-
-struct Particle;
-using Cell = std::list<Particle*>;
-using Grid = std::vector<Cell>;
-
-enum ParticleType {
-    F,
-    A,
-    B,
-    S,
-    L
-};
-
-// Simple struct to hold particle data
-struct Particle {
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    float orientation;
-    //float midAngle; //debug
-    float angularVelocity;
-    sf::Vector2f force;
-    float torque;
-    ParticleType type;
-    int spawnStep;
-    //std::vector<Particle*> linked;
-    //Having view related objects in the model object is not ideal
-    //but in SFML not rebuilding the graphical object is significantly faster
-    sf::CircleShape shape;
-    Cell* cell;
-};
-
-//////////////////////////////////////////////////////////////////////////////
-float angleFromVector(sf::Vector2f v) {
-    return std::atan2(v.y, v.x);
-}
+static int g_max_steps_per_second = 600; // 0 for no limit
+static char s_checkpoint_path[256] = "particlelife.ckpt";
 
 //////////////////////////////////////////////////////////////////////////////
-sf::Vector2f unitVectorFromAngle(float iAngle) {
-    return sf::Vector2f(std::cos(iAngle), std::sin(iAngle));
-}
+// The simulation thread owns the model config, the GUI edits a copy of it and
+// sends every change as a command
+static std::vector<ParamValue> s_params;
+static SimulationThread* s_simulation = nullptr;
 
-//////////////////////////////////////////////////////////////////////////////
-sf::Vector2f rotateVector(const sf::Vector2f& v, float alpha) {
-    float cs = std::cos(alpha);
-    float sn = std::sin(alpha);
-
-    sf::Vector2f rotatedVector;
-    rotatedVector.x = v.x * cs - v.y * sn;
-    rotatedVector.y = v.x * sn + v.y * cs;
-    return rotatedVector;
+static int paramIndex(const char* iName) {
+    return (int)(findParam(iName) - getParams().data());
 }
 
-float dot(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-    return v1.x * v2.x + v1.y * v2.y;
+// Before the simulation thread starts
+static void initGuiParams() {
+    s_params.resize(getParams().size());
+    for (int k = 0; k < (int)s_params.size(); ++k)
+        s_params[k] = getParams()[k].get(s_simulation->model.config);
 }
 
-/*
-float colinearFactor(sf::Vector2f v1, sf::Vector2f v2) {
-    float dotProduct = v1.x * v2.x + v1.y * v2.y;
-    float lengthsProduct = std::sqrt(v1.x * v1.x + v1.y * v1.y) * std::sqrt(v2.x * v2.x + v2.y * v2.y);
+static int* guiInt(const char* iName) { return &s_params[paramIndex(iName)].i; }
+static float* guiFloat(const char* iName) { return &s_params[paramIndex(iName)].f; }
+static bool* guiBool(const char* iName) { return &s_params[paramIndex(iName)].b; }
 
-    // prevent division by zero
-    if(lengthsProduct == 0.f)
-        return 0.f;
-
-    float cosineOfAngle = dotProduct / lengthsProduct;
-
-    // Clamp the value to the [-1, 1] range, in case of numerical instability
-    cosineOfAngle = std::max(-1.f, std::min(1.f, cosineOfAngle));
+static void sendParam(const char* iName) {
+    int k = paramIndex(iName);
+    ParamValue value = s_params[k];
+    s_simulation->push([k, value](SimulationThread& ioSimulation) {
+        getParams()[k].set(ioSimulation.model.config, value);
+    });
+}
 
-    return cosineOfAngle;
+static void sliderParam(const char* iLabel, const char* iName, float iMin, float iMax) {
+    if (ImGui::SliderFloat(iLabel, guiFloat(iName), iMin, iMax))
+        sendParam(iName);
 }
-*/
 
-//////////////////////////////////////////////////////////////////////////////
-float norm(const sf::Vector2f& vec) {
-    return std::sqrt(vec.x * vec.x + vec.y * vec.y);
+static void checkboxParam(const char* iLabel, const char* iName) {
+    if (ImGui::Checkbox(iLabel, guiBool(iName)))
+        sendParam(iName);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-void normalize(sf::Vector2f& vec)
-{
-    float normVec = norm(vec);
-    if (!normVec == 0) vec /= normVec;
+// Conversions between the model vectors and SFML
+sf::Vector2f toSf(const Vec2f& v) {
+    return sf::Vector2f(v.x, v.y);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-double middleAngle(double theta1, double theta2) {
-    // Make sure theta1 and theta2 are in the range of [0, 2*PI]
-    theta1 = fmod(theta1, 2*M_PI);
-    if (theta1 < 0)
-        theta1 += 2*M_PI;
-
-    theta2 = fmod(theta2, 2*M_PI);
-    if (theta2 < 0)
-        theta2 += 2*M_PI;
-
-    // Compute difference
-    double diff = theta2 - theta1;
-    if (diff < -M_PI)
-        diff += 2*M_PI;
-    else if (diff > M_PI)
-        diff -= 2*M_PI;
-
-    // Compute middle angle
-    double middle = theta1 + diff / 2.0;
-
-    // Make sure the middle angle is in the range of [0, 2*PI]
-    middle = fmod(middle, 2*M_PI);
-    if (middle < 0)
-        middle += 2*M_PI;
-
-    return middle;
+Vec2f toVec2f(const sf::Vector2f& v) {
+    return Vec2f(v.x, v.y);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -214,482 +125,459 @@ sf::Color getColor(const ParticleType& iParticleType) {
 }
 
 
-//////////////////////////////////////////////////////////////////////////////
-struct Plug
-{
-    Grid grid;
 
-    Plug() {
-        grid.resize(PLUG_NX*PLUG_NY);
-    };
-
-    int ij2k(const sf::Vector2i& ij) const{
-        return PLUG_NX*ij.y+ij.x;
-    }
-    sf::Vector2i k2ij(int k) const {
-        int i = k % PLUG_NX;
-        int j = (k-i)/PLUG_NX;
-        return sf::Vector2i{ i,j };
-    }
-
-    sf::Vector2i locate(const sf::Vector2f& pos) const {
-        sf::Vector2i ij;
-        ij.x = floor((pos.x+.5*WORLD_WIDTH)/PLUG_DX);
-        ij.y = floor((pos.y+.5*WORLD_HEIGTH)/PLUG_DY);
-        if(pos.x+.5*WORLD_WIDTH < 0.)
-            ij.x = 0;
-        if(pos.y+.5*WORLD_HEIGTH < 0.)
-            ij.y = 0;
-        if(pos.x+.5*WORLD_WIDTH > WORLD_WIDTH)
-            ij.x = PLUG_NX-1;
-        if(pos.y+.5*WORLD_HEIGTH > WORLD_HEIGTH)
-            ij.y = PLUG_NY-1;
-        return ij;
-    }
-    Cell* getCell(const Particle& part) {
-        const sf::Vector2f& pos = part.position;
-        int k = ij2k(locate(pos));
-        return &grid[k];
-    }
-    std::list<Cell*>& getNeghbourCells(const Particle& part, std::list<Cell*>& neighbour) {
-        int nx = g_interaction_radius/PLUG_DX+1;
-        int ny = g_interaction_radius/PLUG_DY+1;
-        sf::Vector2i ij = locate(part.position);
-        sf::Vector2i ijc = ij-sf::Vector2i{ nx,ny };
-        for(; ijc.x <= ij.x+nx; ++ijc.x)
-        {
-            if(ijc.x < 0 || ijc.x >= PLUG_NX)
-                continue;
-            for(; ijc.y <= ij.y+ny; ++ijc.y)
-            {
-                if(ijc.y < 0 || ijc.y >= PLUG_NY)
-                    continue;
-                int k = ij2k(ijc);
-                neighbour.push_back(&grid[k]);
-            }
-            ijc.y = ij.y-ny;
+//////////////////////////////////////////////////////////////////////////////
+// Batched view of the model: the vertex arrays are refilled in place every
+// frame (no allocation once the population is reached) and each one is
+// submitted with a single draw call
+// Only the plug cells of the snapshot that intersect the view are visited.
+// When a cell is narrower than g_density_cell_pixels on screen the particles
+// are replaced by a texture of the density per type, one texel per block of
+// cells of at least a pixel: the cost follows the visible cells, not the
+// population.
+struct ParticleRenderer {
+    static const int kDotSegments = 8;
+    static const int kHaloSegments = 16;
+    static const int kRadiusSegments = 32;
+    sf::VertexArray dots{sf::Triangles};
+    sf::VertexArray tails{sf::Lines};
+    sf::VertexArray halos{sf::Triangles};
+    sf::VertexArray radiusOutlines{sf::Lines};
+    sf::VertexArray emitterOutlines{sf::Lines};
+    // Circle outlines of each primitive, radius included
+    std::vector<sf::Vector2f> dotOffsets;
+    std::vector<sf::Vector2f> haloOffsets;
+    std::vector<sf::Vector2f> radiusOffsets;
+    std::vector<sf::Vector2f> emitterOffsets;
+    // Density view
+    std::vector<float> densitySums; // r, g, b and particle count per texel
+    std::vector<sf::Uint8> densityPixels;
+    sf::Texture densityTexture;
+    sf::Sprite densitySprite;
+    bool densityDrawn = false;
+    int densityWidth = 0; // texels
+    int densityHeight = 0;
+    // Last frame
+    int nbDrawn = 0; // particles, or represented by the density texture
+    int nbCellsDrawn = 0;
+
+    static void updateOffsets(std::vector<sf::Vector2f>& oOffsets, int iNbSegments, float iRadius) {
+        oOffsets.resize(iNbSegments+1);
+        for (int s = 0; s <= iNbSegments; ++s) {
+            float angle = 2.0f*M_PI*s/iNbSegments;
+            oOffsets[s] = sf::Vector2f(iRadius*std::cos(angle), iRadius*std::sin(angle));
         }
-        return neighbour;
-    }
-    void addParticle(Particle& part) {
-        Cell* cell = getCell(part);
-        cell->push_back(&part);
-        part.cell = cell;
     }
-    void removeParticle(const Particle& part) {
-        Cell* cell = part.cell;
-        auto it = std::find(cell->begin(),cell->end(),&part);
-        cell->erase(it);
+    static void appendDisc(sf::VertexArray& ioArray, const sf::Vector2f& iCenter,
+                           const std::vector<sf::Vector2f>& iOffsets, const sf::Color& iColor) {
+        for (int s = 0; s+1 < (int)iOffsets.size(); ++s) {
+            ioArray.append(sf::Vertex(iCenter, iColor));
+            ioArray.append(sf::Vertex(iCenter + iOffsets[s], iColor));
+            ioArray.append(sf::Vertex(iCenter + iOffsets[s+1], iColor));
+        }
     }
-    void updateCell(Particle& part) {
-        const sf::Vector2f& pos = part.position;
-        int k = ij2k(locate(pos));
-        if(&grid[k] != part.cell)
-        {
-            removeParticle(part);
-            addParticle(part);
+    static void appendOutline(sf::VertexArray& ioArray, const sf::Vector2f& iCenter,
+                              const std::vector<sf::Vector2f>& iOffsets, const sf::Color& iColor) {
+        for (int s = 0; s+1 < (int)iOffsets.size(); ++s) {
+            ioArray.append(sf::Vertex(iCenter + iOffsets[s], iColor));
+            ioArray.append(sf::Vertex(iCenter + iOffsets[s+1], iColor));
         }
     }
-};
-//////////////////////////////////////////////////////////////////////////////
-
-struct Model {
-    std::list<Particle> particles; //BAD choice of container if dynamic
-    std::random_device rd;
-    std::mt19937 gen;
-    int _step;
-    Plug plug;
 
-    Model() : gen(rd()){
-        init();
+    //////////////////////////////////////////////////////////////////////////////
+    // Cells of the snapshot that intersect [iLow,iHigh], clamped to its cell
+    // bounds: in the dense layout the border cells also hold the particles out
+    // of the grid
+    static CellRange getVisibleCells(const RenderSnapshot& iSnapshot, const sf::Vector2f& iLow, const sf::Vector2f& iHigh) {
+        // Far enough from any cell coordinate to stay an int
+        auto toCell = [](float iCoordinate) {
+            return (int)std::max(-1.0e9f, std::min(1.0e9f, std::floor(iCoordinate)));
+        };
+        CellRange range;
+        range.i0 = toCell((iLow.x - iSnapshot.cellOrigin.x)/iSnapshot.cellWidth);
+        range.i1 = toCell((iHigh.x - iSnapshot.cellOrigin.x)/iSnapshot.cellWidth);
+        range.j0 = toCell((iLow.y - iSnapshot.cellOrigin.y)/iSnapshot.cellHeight);
+        range.j1 = toCell((iHigh.y - iSnapshot.cellOrigin.y)/iSnapshot.cellHeight);
+        const CellRange& bounds = iSnapshot.cellBounds;
+        range.i0 = std::max(bounds.i0, std::min(bounds.i1, range.i0));
+        range.i1 = std::max(bounds.i0, std::min(bounds.i1, range.i1));
+        range.j0 = std::max(bounds.j0, std::min(bounds.j1, range.j0));
+        range.j1 = std::max(bounds.j0, std::min(bounds.j1, range.j1));
+        return range;
     }
-
-    void init() {
-        _step = 0;
-        // Initialize particles
-        particles.clear();
-        for (int i = 0; i < K_INIT_PARTICLES; ++i) {
-            spawn((ParticleType)(i % 4), sf::Vector2f(0, 0), 0);
+    // Calls f(cell) for the occupied cells of iRange, the rows are skipped by
+    // binary search so the empty parts of the range cost nothing
+    template<typename Function>
+    static void forEachVisibleCell(const RenderSnapshot& iSnapshot, const CellRange& iRange, Function f) {
+        const std::vector<RenderCell>& cells = iSnapshot.cells;
+        auto seek = [&cells](int j, int i) {
+            return std::lower_bound(cells.begin(), cells.end(), std::make_pair(j, i),
+                                    [](const RenderCell& iCell, const std::pair<int, int>& iKey) {
+                return iCell.j != iKey.first ? iCell.j < iKey.first : iCell.i < iKey.second;
+            });
+        };
+        std::vector<RenderCell>::const_iterator it = seek(iRange.j0, iRange.i0);
+        while (it != cells.end() && it->j <= iRange.j1) {
+            if (it->i < iRange.i0)
+                it = seek(it->j, iRange.i0);
+            else if (it->i > iRange.i1)
+                it = seek(it->j+1, iRange.i0);
+            else
+                f(*it++);
         }
     }
 
-    void spawn(const ParticleType& iParticleType, sf::Vector2f iOrigin, int iSpawnStep) {
-        int spawningFactor = 10;
-        std::uniform_int_distribution<> disType(0, K_NB_TYPE-1);
-        std::uniform_real_distribution<> disX(-WORLD_WIDTH/(2*spawningFactor), WORLD_WIDTH/(2*spawningFactor));
-        std::uniform_real_distribution<> disY(-WORLD_HEIGTH/(2*spawningFactor), WORLD_HEIGTH/(2*spawningFactor));
-        std::uniform_real_distribution<> disV(-0.5, 0.5);
-        std::uniform_real_distribution<> disA(0, 2.0*M_PI);
-
-        Particle p;
-        p.position = sf::Vector2f(disX(gen), disY(gen));
-        p.position += iOrigin;
-        p.velocity = sf::Vector2f(disV(gen), disV(gen));
-        p.orientation = disA(gen);
-        p.angularVelocity = 0.0;
-        p.type = iParticleType;
-        p.shape = sf::CircleShape(DOT_SIZE);
-        p.shape.setOrigin(DOT_SIZE, DOT_SIZE);
-        p.shape.setPosition(p.position);
-        p.spawnStep = iSpawnStep;
-        particles.push_back(p);
-        plug.addParticle(particles.back());
-    }
-
     //////////////////////////////////////////////////////////////////////////////
-    void calculateForceAndTorque_polar1(Particle& p,
-                                        Particle& other,
-                                        const sf::Vector2f& r,
-                                        float rNorm,
-                                        sf::Vector2f& oForce,
-                                        float& oTorque) {
-        const sf::Vector2f& pos1 = p.position;
-        const sf::Vector2f& pos2 = other.position;
-        float orientation1 = p.orientation;
-        float orientation2 = other.orientation;
-
-        // The interaction strength
-        float teta = orientation2 - orientation1;
-        // Make sure it is between -pi and pi
-        while (teta > M_PI) teta -= 2 * M_PI;
-        while (teta < -M_PI) teta += 2 * M_PI;
-        float phi = angleFromVector(r) - orientation1;
-        float anti_phi = angleFromVector(-r) - orientation2;
-        // Make sure it is between -pi and pi
-        while (phi > M_PI) phi -= 2 * M_PI;
-        while (phi < -M_PI) phi += 2 * M_PI;
-        while (anti_phi > M_PI) anti_phi -= 2 * M_PI;
-        while (anti_phi < -M_PI) anti_phi += 2 * M_PI;
-
-        float opposition = std::max(std::abs(phi), std::abs(anti_phi));
-
-        //Here I need a f such that:
-        //f(teta, phi) = f(-teta, phi-teta+pi) //action reaction symmetry)
-        //f(teta, phi) = f(-teta, -phi) //mirror symmetry
-        float anisoFactor = 1.0f;//sin(teta)*sin(phi)+sin(teta)*sin(phi-teta) + 1.6f;
-        float g_opposition_threshold_sp = 0.1;
-        if (opposition < g_opposition_threshold-g_opposition_threshold_sp) {
-            anisoFactor = -1.0f;
-        } else if (opposition < g_opposition_threshold+g_opposition_threshold_sp) {
-            anisoFactor = ((opposition - (g_opposition_threshold-g_opposition_threshold_sp))/(2*g_opposition_threshold_sp))*2.0-1.0; //supposed to be in -1.0 1.0
+    void appendParticle(const RenderSnapshot& iSnapshot, int i, float iPersistenceSteps) {
+        const sf::Vector2f position = toSf(iSnapshot.position[i]);
+        const ParticleType type = iSnapshot.type[i];
+        const int spawnStep = iSnapshot.spawnStep[i];
+        const sf::Color color = getColor(type);
+
+        // Tail
+        if (type == ParticleType::S) {
+            float tailLength = 10.0;
+            Vec2f heading = unitVectorFromAngle(iSnapshot.orientation[i]);
+            tails.append(sf::Vertex(position, sf::Color::White));
+            tails.append(sf::Vertex(position - toSf(tailLength*heading), sf::Color::White));
         }
-        //if (((2*phi-teta+M_PI)*(2*phi-teta+M_PI)+teta*teta) < 2.0*g_div_angle*g_div_angle) anisoFactor = -1.0f;
-        //2*phi-teta is an invariant angle in an interacting pair
-        float rotatorFactor = sin(2*phi-teta+M_PI);//(sin(teta)*sin(phi)+sin(teta)*sin(phi-teta))/2.0f;// * M_PI;
-        float distanceFactor = 1.0f / std::pow(rNorm, g_s_f_exp_power);
-
-        oForce = rotateVector(r, rotatorFactor) * (10.0f*rotatorFactor*rotatorFactor + 1.0f) * g_s_f_strength * anisoFactor * distanceFactor;
-
-        //Something like (phi>0)
-        float midAngle = middleAngle(orientation1, orientation2);
-        bool isLeft = dot(r, rotateVector(unitVectorFromAngle(midAngle), -M_PI/2.0)) > 0;
-
-        //Debug left right
-        //if(isLeft) {p.shape.setFillColor(sf::Color::Red);} else {p.shape.setFillColor(sf::Color::Blue);}
-
-        float leftTargetOffset = (-teta-g_div_angle)/2.0;
-        float righTargetOffset = (-teta+g_div_angle)/2.0;
-        while (leftTargetOffset > M_PI) leftTargetOffset -= 2 * M_PI;
-        while (leftTargetOffset < -M_PI) leftTargetOffset += 2 * M_PI;
-        while (righTargetOffset > M_PI) righTargetOffset -= 2 * M_PI;
-        while (righTargetOffset < -M_PI) righTargetOffset += 2 * M_PI;
-        float dirFactor = ((isLeft && (leftTargetOffset<0)) || (!isLeft && (righTargetOffset<0))) ? 1.0f : -1.0f;
-        oTorque = dirFactor*g_s_t_strength;
-
-        //Torque influence as well diminish with distance
-        oTorque = oTorque/(rNorm);
-
-        //Mutual viscosity system (particles try to slow to the center of mass of the system)
-        //TODO repulsion should be an exception!
-        oForce += ((p.velocity+other.velocity)/2.0f-p.velocity)*g_s_f_viscosity;
-        oTorque += ((p.angularVelocity+other.angularVelocity)/2.0f-p.angularVelocity)*g_s_t_viscosity;
-    }
 
-    //////////////////////////////////////////////////////////////////////////////
-    //void calculateForce_linearAttraction(float forceMagnitude, const sf::Vector2f& r, float rNorm, sf::Vector2f& force) {
-    //    force = r * (forceMagnitude / rNorm);
-    //}
+        // Halo of the recently transformed particles
+        if (iSnapshot.step > spawnStep && iSnapshot.step < spawnStep+iPersistenceSteps)
+        {
+            float alpha = 1.0f*(iSnapshot.step-spawnStep)/iPersistenceSteps;
+            if (alpha < 0.25) {alpha = 4*alpha;}
+            else if (alpha > 0.25) {alpha = 1.0-(alpha-0.25)/0.75;}
+            sf::Color haloColor = color;
+            haloColor.a = alpha * 255;
+            appendDisc(halos, position, haloOffsets, haloColor);
+        }
 
-    //////////////////////////////////////////////////////////////////////////////
-    void calculateForce_quadraticAttraction(float forceMagnitude, const sf::Vector2f& r, float rNorm, sf::Vector2f& force) {
-        force = r * (forceMagnitude / (rNorm*rNorm));
+        appendDisc(dots, position, dotOffsets, color);
+
+        //Draw interaction radius
+        if (type == ParticleType::S && g_draw_s_interaction_radius)
+            appendOutline(radiusOutlines, position, radiusOffsets, sf::Color::Green);
     }
 
     //////////////////////////////////////////////////////////////////////////////
-    void step() {
-        ++_step;
-        // Calculate the force and torque on particle p due to all other particles
-        for (auto itp = particles.begin(); itp != particles.end();) {
-            auto& p = *itp;
-            p.force = sf::Vector2f(0.0, 0.0);
-            p.torque = 0.0;
-
-            //General forces with any other particles
-            std::list<Cell*> neighbour{};
-            plug.getNeghbourCells(p,neighbour);
-            for(Cell* cell: neighbour)
-            {
-                for (Particle* pother : *cell)
-                {
-                    Particle& other = *pother;
-                    // for(Particle& other : particles)
-                    // {
-                    if (&other != &p)
-                    {  // Avoid self-interaction
-                        sf::Vector2f r = other.position - p.position;
-                        float rNorm = norm(r);
-                        sf::Vector2f force(0.0, 0.0);
-                        float torque = 0.0;
-                        // Surfactant molecules S interaction model
-                        if (p.type == ParticleType::S && other.type == ParticleType::S)
-                        {
-                            if (rNorm < g_interaction_radius) {  // Consider only particles within the interaction radius
-                                // Calculate force and torque using appropriate model
-                                //Force model for vesicle formation
-                                calculateForceAndTorque_polar1(p, other,
-                                                               r, rNorm,
-                                                               force, torque);
-
-                                p.force += force;
-                                p.torque += torque;
-
-                                //Solid repulsion
-                                if (rNorm < 2.0*2.0*DOT_SIZE) //The first 2 is for progressive smoothing
-                                {
-                                    float factor = std::pow(2.0*DOT_SIZE/rNorm, 9);
-                                    p.force += -r * factor;
-                                }
-                            }
-                        }
-                        else if ((p.type == ParticleType::S && (other.type == ParticleType::A ||
-                                                                other.type == ParticleType::B ||
-                                                                other.type == ParticleType::L)) ||
-                                 (other.type == ParticleType::S && (p.type == ParticleType::A ||
-                                                                    p.type == ParticleType::B ||
-                                                                    p.type == ParticleType::L)))
-                        {
-                            // Surfactant molecules S walling model
-                            if (rNorm < g_interaction_radius) {
-                                // Negative for repulsion
-                                //calculateForce_quadraticAttraction(-0.001, r, rNorm, force);
-                                float factor = std::pow(2.0*DOT_SIZE/rNorm, 6);
-                                p.force += -r * factor * (p.type != ParticleType::S ? 10.0f : 0.001f);
-                                p.force += force;
-                            }
-                        }
-                        else if ((p.type == ParticleType::A && other.type == ParticleType::F) ||
-                                 (other.type == ParticleType::A && p.type == ParticleType::F))
-                        {
-                            //Chemical force 1: F makes B when catalysed by A
-                            if (rNorm < g_interaction_radius/2.0) {
-                                //Maybe TODO a commit mecahnism
-                                if (p.type == ParticleType::F) {p.type = ParticleType::B; p.spawnStep = _step;}
-                                if (other.type == ParticleType::F) {other.type = ParticleType::B; other.spawnStep = _step;}
-                            }
-                        }
-                        else if ((p.type == ParticleType::B && other.type == ParticleType::F) ||
-                                 (other.type == ParticleType::B && p.type == ParticleType::F))
-                        {
-                            //Chemical force 2: F + B makes A + S
-                            if (rNorm < g_interaction_radius/2.0) {
-                                p.type = ParticleType::A;
-                                other.type = ParticleType::S;
-                                p.spawnStep = _step;
-                                other.spawnStep = _step;
-                            }
-                        }
-                        else if ((p.type == ParticleType::L && other.type == ParticleType::A) ||
-                                 (other.type == ParticleType::A && p.type == ParticleType::L))
-                        {
-                            //Chemical force 3: R + A makes R + F // Test reaction limitor
-                            if (rNorm < g_interaction_radius/2.0) {
-                                p.type = ParticleType::F;
-                                other.type = ParticleType::L;
-                                p.spawnStep = _step;
-                                other.spawnStep = _step;
-                            }
-                        }
-                    }
-                }
+    // Mean colour of the particles of each texel, opaque once they would cover
+    // half of it
+    void updateDensity(const RenderSnapshot& iSnapshot, const CellRange& iRange, float iPixelsPerUnit) {
+        int block = std::max(1, (int)std::ceil(1.0f/(iSnapshot.cellWidth*iPixelsPerUnit)));
+        densityWidth = (iRange.i1-iRange.i0)/block+1;
+        densityHeight = (iRange.j1-iRange.j0)/block+1;
+        densitySums.assign(4*densityWidth*densityHeight, 0.0f);
+        forEachVisibleCell(iSnapshot, iRange, [&](const RenderCell& iCell) {
+            float* sums = &densitySums[4*(densityWidth*((iCell.j-iRange.j0)/block) + (iCell.i-iRange.i0)/block)];
+            for (int t = 0; t < kNbParticleTypes; ++t) {
+                sf::Color color = getColor((ParticleType)t);
+                sums[0] += iCell.count[t]*color.r;
+                sums[1] += iCell.count[t]*color.g;
+                sums[2] += iCell.count[t]*color.b;
+                sums[3] += iCell.count[t];
             }
+            nbDrawn += iCell.last-iCell.first;
+            ++nbCellsDrawn;
+        });
+        float texelArea = block*block*iSnapshot.cellWidth*iSnapshot.cellHeight;
+        float fullCount = 0.5f*texelArea/(M_PI*DOT_SIZE*DOT_SIZE);
+        densityPixels.resize(4*densityWidth*densityHeight);
+        for (int t = 0; t < densityWidth*densityHeight; ++t) {
+            const float* sums = &densitySums[4*t];
+            sf::Uint8* pixel = &densityPixels[4*t];
+            float count = std::max(1.0f, sums[3]);
+            pixel[0] = (sf::Uint8)(sums[0]/count);
+            pixel[1] = (sf::Uint8)(sums[1]/count);
+            pixel[2] = (sf::Uint8)(sums[2]/count);
+            pixel[3] = (sf::Uint8)(255.0f*std::min(1.0f, std::sqrt(sums[3]/fullCount)));
+        }
+        sf::Vector2u size = densityTexture.getSize();
+        if ((int)size.x < densityWidth || (int)size.y < densityHeight) {
+            densityTexture.create(std::max<int>(size.x, densityWidth), std::max<int>(size.y, densityHeight));
+            densityTexture.setSmooth(true);
+        }
+        densityTexture.update(densityPixels.data(), densityWidth, densityHeight, 0, 0);
+        densitySprite.setTexture(densityTexture);
+        densitySprite.setTextureRect(sf::IntRect(0, 0, densityWidth, densityHeight));
+        densitySprite.setPosition(iSnapshot.cellOrigin.x + iRange.i0*iSnapshot.cellWidth,
+                                  iSnapshot.cellOrigin.y + iRange.j0*iSnapshot.cellHeight);
+        densitySprite.setScale(block*iSnapshot.cellWidth, block*iSnapshot.cellHeight);
+    }
 
-            //Link forces
-            /*assert(p.linked.size() <= 1);
-              for (Particle* otherLinked : p.linked) {
-              if (otherLinked != &p) {  // Avoid self-interaction
-              sf::Vector2f r = otherLinked->position - p.position;
-              float rNorm = norm(r);
-              // Calculate force and torque using appropriate model
-              sf::Vector2f force(0.0, 0.0);
-              float torque = 0.0;
-              //Force model for vesicle formation
-              calculateForce_linearAttraction(20.0f, r, rNorm, force);
-              p.force += force;
-              p.torque += torque;
-              }
-              }*/
-
-            if (g_destroy_at_boundary) { //p.type == ParticleType::S ||
-                // Containing delete
-                if ((p.position.x > WORLD_WIDTH/2) || (p.position.x < -WORLD_WIDTH/2) || (p.position.y > WORLD_HEIGTH/2) || (p.position.y < -WORLD_HEIGTH/2)) {
-                    plug.removeParticle(p);
-                    itp = particles.erase(itp);
-                    continue;
-                }
-            } else {
-                // Containing forces //could be constrained by direction of v as well
-                if (p.position.x > WORLD_WIDTH/2) p.force += sf::Vector2f(-g_containing_force,0.0);
-                if (p.position.x < -WORLD_WIDTH/2) p.force += sf::Vector2f(g_containing_force,0.0);
-                if (p.position.y > WORLD_HEIGTH/2) p.force += sf::Vector2f(0.0,-g_containing_force);
-                if (p.position.y < -WORLD_HEIGTH/2) p.force += sf::Vector2f(0.0,g_containing_force);
-            }
+    //////////////////////////////////////////////////////////////////////////////
+    void draw(sf::RenderWindow& ioWindow, const sf::RectangleShape& iWorldRect, const RenderSnapshot& iSnapshot) {
+        // Radii follow the sliders
+        updateOffsets(dotOffsets, kDotSegments, DOT_SIZE);
+        updateOffsets(haloOffsets, kHaloSegments, 3*DOT_SIZE);
+        updateOffsets(radiusOffsets, kRadiusSegments, *guiFloat("interaction_radius"));
+        dots.clear();
+        tails.clear();
+        halos.clear();
+        radiusOutlines.clear();
+        nbDrawn = 0;
+        nbCellsDrawn = 0;
+        densityDrawn = false;
+        float persistenceSteps = g_persistence*iSnapshot.stepsPerSecond;
+
+        const sf::View& view = ioWindow.getView();
+        sf::Vector2f low = view.getCenter() - view.getSize()/2.0f;
+        sf::Vector2f high = view.getCenter() + view.getSize()/2.0f;
+        float pixelsPerUnit = ioWindow.getSize().x/view.getSize().x;
+        if (iSnapshot.cells.empty()) {
+            for (int i = 0; i < iSnapshot.size(); ++i)
+                appendParticle(iSnapshot, i, persistenceSteps);
+            nbDrawn = iSnapshot.size();
+        } else if (g_density_view && iSnapshot.cellWidth*pixelsPerUnit < g_density_cell_pixels) {
+            updateDensity(iSnapshot, getVisibleCells(iSnapshot, low, high), pixelsPerUnit);
+            densityDrawn = true;
+        } else {
+            // Shapes reach this far from their particle, and the particles may
+            // have left their cell by a step of motion since the plug rebuild
+            float reach = std::max(10.0f, 3.0f*DOT_SIZE);
+            if (g_draw_s_interaction_radius)
+                reach = std::max(reach, *guiFloat("interaction_radius"));
+            sf::Vector2f margin(reach + iSnapshot.cellWidth, reach + iSnapshot.cellHeight);
+            forEachVisibleCell(iSnapshot, getVisibleCells(iSnapshot, low - margin, high + margin), [&](const RenderCell& iCell) {
+                for (int i = iCell.first; i < iCell.last; ++i)
+                    appendParticle(iSnapshot, i, persistenceSteps);
+                nbDrawn += iCell.last-iCell.first;
+                ++nbCellsDrawn;
+            });
+        }
 
-            // Brownian motion model
-            // Particle are boosted in the direction of their velocity below a given value.
-            // + a rotation perturbation
-            if (p.type == ParticleType::S) {
-                if (norm(p.velocity) <= g_temp_speed)
-                {
-                    p.force += 0.01f*p.velocity / g_dt;
-                }
-                //std::uniform_real_distribution<> disBrownian(-0.01, 0.01);
-                //p.force += sf::Vector2f(disBrownian(gen), disBrownian(gen));
+        // Emitter regions
+        emitterOutlines.clear();
+        for (const Emitter& emitter : iSnapshot.emitters) {
+            sf::Vector2f center = toSf(emitter.center);
+            sf::Vector2f half = toSf(emitter.halfSize);
+            if (emitter.shape == Emitter::Disc) {
+                updateOffsets(emitterOffsets, kRadiusSegments, half.x);
+                appendOutline(emitterOutlines, center, emitterOffsets, sf::Color::White);
             } else {
-                if (norm(p.velocity) <= 1.0)
-                {
-                    p.force += 0.01f*p.velocity / g_dt;
-                }
-                std::uniform_real_distribution<> disBrownian(-0.01, 0.01);
-                p.force += sf::Vector2f(disBrownian(gen), disBrownian(gen));
+                const sf::Vector2f corners[5] = {{-half.x, -half.y}, {half.x, -half.y}, {half.x, half.y},
+                                                 {-half.x, half.y}, {-half.x, -half.y}};
+                emitterOffsets.assign(corners, corners+5);
+                appendOutline(emitterOutlines, center, emitterOffsets, sf::Color::White);
             }
-
-            //Done here because it's an erase loop
-            ++itp;
         }
 
-        // Update particles from forces
-        for (auto& p : particles) {
-            // Calculate the acceleration and angular acceleration (assuming mass and moment of inertia = 1)
-            sf::Vector2f acceleration = p.force;
-            float angularAcceleration = p.torque;
-
-            // Using naive algo
-            p.velocity = p.velocity + acceleration * g_dt;
-            p.angularVelocity = p.angularVelocity + angularAcceleration * g_dt;
-
-            // Cap velocity
-            float maxVelocity = 2.0;
-            if (norm(p.velocity) > maxVelocity) {
-                normalize(p.velocity);
-                p.velocity *= maxVelocity;
-            }
-
-            // Cap angular velocity
-            float maxAngularVelocity = 10.0;
-            if (p.angularVelocity > maxAngularVelocity) p.angularVelocity = maxAngularVelocity;
-            if (p.angularVelocity < -maxAngularVelocity) p.angularVelocity = -maxAngularVelocity;
-
-            //Force attract to center to incentive interactions
-            if (g_centerize) {
-                p.velocity -= g_center_force * p.position;
-            }
-
-            //Sticky dissipative space and other limits
-            p.velocity = g_void_viscosity * p.velocity;
-            p.angularVelocity *= g_void_torque_viscosity;
-
-            // Update
-            p.position = p.position + p.velocity * g_dt;
-            p.orientation = p.orientation + p.angularVelocity * g_dt;
-
-            // Update the particle's shape position
-            p.shape.setPosition(p.position);
-            p.shape.setFillColor(getColor(p.type));
-
-            plug.updateCell(p);
+        if (densityDrawn) {
+            ioWindow.draw(densitySprite);
+        } else {
+            ioWindow.draw(tails);
+            ioWindow.draw(halos);
+            ioWindow.draw(dots);
+            ioWindow.draw(radiusOutlines);
         }
+        ioWindow.draw(emitterOutlines);
+        ioWindow.draw(iWorldRect);
     }
 };
 
-void drawModel(sf::RenderWindow& ioWindow, const sf::RectangleShape& iWorldRect, const Model& iModel) {
-    for (const auto& p : iModel.particles)
-    {
-        // Links
-        //sf::VertexArray lines(sf::Lines, 2);
-        //for (auto& other : p.linked) {
-        //    lines[0].position = p.position;
-        //    lines[1].position = other->position;
-        //    lines[0].color = sf::Color::Green;
-        //    lines[1].color = sf::Color::Green;
-        //ioWindow.draw(lines);
-        //}
+//////////////////////////////////////////////////////////////////////////////
+// Rolling per frame histograms of the profiler phases and counters, trace export
+static int s_trace_frames = 60;
+
+void drawProfilerWindow() {
+    ImGui::Begin("Profiler");
+    bool enabled = g_profiler.enabled;
+    if (ImGui::Checkbox("Enable timers", &enabled))
+        g_profiler.enabled = enabled;
+    char overlay[64];
+    for (int k = 0; k < Profiler::kNbPhases; ++k) {
+        std::snprintf(overlay, sizeof(overlay), "%.3f ms", g_profiler.meanTime(k));
+        ImGui::PlotHistogram(Profiler::phaseName(k), g_profiler.timeHistory[k], Profiler::kHistory,
+                             g_profiler.historyOffset, overlay, 0.0f, 4.0f*g_profiler.meanTime(k)+1e-3f, ImVec2(0, 40));
+    }
+    for (int k = 0; k < Profiler::kNbCounters; ++k) {
+        std::snprintf(overlay, sizeof(overlay), "%.0f", g_profiler.meanCount(k));
+        ImGui::PlotHistogram(Profiler::counterName(k), g_profiler.counterHistory[k], Profiler::kHistory,
+                             g_profiler.historyOffset, overlay, 0.0f, 2.0f*g_profiler.meanCount(k)+1.0f, ImVec2(0, 40));
+    }
+    ImGui::InputInt("Trace frames", &s_trace_frames);
+    s_trace_frames = std::max(1, std::min(s_trace_frames, Profiler::kHistory));
+    if (!g_profiler.tracing() && ImGui::Button("Write trace"))
+        g_profiler.startTrace(s_trace_frames, "particlelife_trace.json");
+    ImGui::Text("%s", g_profiler.traceStatus.c_str());
+    ImGui::End();
+}
 
-        // Tail
-        if (p.type == ParticleType::S) {
-            float tailLength = 10.0;
-            sf::Vertex line[] =
-                {
-                    sf::Vertex(p.position, sf::Color::White),
-                    sf::Vertex(p.position + tailLength*unitVectorFromAngle(p.orientation+M_PI), sf::Color::White)
-                };
-            ioWindow.draw(line, 2, sf::Lines);
+//////////////////////////////////////////////////////////////////////////////
+// Recording of the live run, and replay of a recording with the simulation paused
+static char s_recording_path[256] = "particlelife.trj";
+static int s_record_interval = 10;
+static TrajectoryReader s_replay;
+static bool s_replaying = false;
+static bool s_replay_playing = false;
+static int s_replay_frame = 0;
+static float s_replay_fps = 30.0f;
+static float s_replay_time = 0.0f; // since the last frame
+static RenderSnapshot s_replay_snapshot;
+static std::string s_replay_status;
+
+void drawRecordingWindow(SimulationThread& ioSimulation, float iDeltaTime) {
+    ImGui::Begin("Recording");
+    ImGui::InputText("File", s_recording_path, sizeof(s_recording_path));
+    if (!s_replaying) {
+        ImGui::InputInt("Steps per frame", &s_record_interval);
+        s_record_interval = std::max(1, s_record_interval);
+        // The recorder is started by the simulation thread, it may fail there
+        if (!ioSimulation.recorder.recording()) {
+            if (ImGui::Button("Record"))
+                ioSimulation.startRecording(s_recording_path, s_record_interval);
+            ImGui::SameLine();
+            if (ImGui::Button("Replay")) {
+                std::string error;
+                if (!s_replay.open(s_recording_path, error)) {
+                    s_replay_status = error;
+                } else if (s_replay.size() == 0) {
+                    s_replay_status = "Empty recording";
+                } else {
+                    s_replay_status = std::to_string(s_replay.size()) + " frames";
+                    s_replaying = true;
+                    s_replay_frame = 0;
+                    s_replay_time = 0.0f;
+                    s_replay.read(0, s_replay_snapshot);
+                    ioSimulation.paused = true;
+                }
+            }
+        } else {
+            ImGui::Text("%d frames, %.1f MB, %d dropped", ioSimulation.recorder.nbFrames.load(),
+                        ioSimulation.recorder.nbBytes/1e6, ioSimulation.recorder.nbDropped.load());
+            if (ImGui::Button("Stop recording"))
+                ioSimulation.stopRecording();
+        }
+        // Outcome of the last start or stop, errors included
+        ImGui::Text("%s", ioSimulation.checkpointStatus().c_str());
+    } else {
+        int frame = s_replay_frame;
+        ImGui::SliderInt("Frame", &frame, 0, s_replay.size()-1);
+        ImGui::Checkbox("Play", &s_replay_playing);
+        ImGui::SameLine();
+        ImGui::SliderFloat("Frames/s", &s_replay_fps, 1.0f, 240.0f);
+        if (s_replay_playing) {
+            s_replay_time += iDeltaTime;
+            int advance = (int)(s_replay_time*s_replay_fps);
+            s_replay_time -= advance/s_replay_fps;
+            frame = std::min(frame+advance, s_replay.size()-1);
+            if (frame == s_replay.size()-1)
+                s_replay_playing = false;
         }
+        if (frame != s_replay_frame && s_replay.read(frame, s_replay_snapshot))
+            s_replay_frame = frame;
+        // Halo persistence in recorded steps
+        s_replay_snapshot.stepsPerSecond = s_replay_fps*s_replay.header.interval;
+        ImGui::Text("Step %d", s_replay_snapshot.step);
+        if (ImGui::Button("Back to simulation")) {
+            s_replay.close();
+            s_replaying = false;
+            s_replay_playing = false;
+            ioSimulation.paused = false;
+        }
+    }
+    ImGui::Text("%s", s_replay_status.c_str());
+    ImGui::End();
+}
 
-        // MidAngle debug
-        //float mdLength = 30.0;
-        //sf::Vertex linemd[] =
-        //{
-        //    sf::Vertex(p.position, sf::Color::Yellow),
-        //    sf::Vertex(p.position + mdLength*unitVectorFromAngle(p.midAngle), sf::Color::Yellow)
-        //};
-        //ioWindow.draw(linemd, 2, sf::Lines);
-
-        //Force debug
-        //sf::Vertex lineF[] =
-        //{
-        //    sf::Vertex(p.position, sf::Color::Red),
-        //    sf::Vertex(p.position + 10.0f*p.force, sf::Color::Red)
-        //};
-        //ioWindow.draw(lineF, 2, sf::Lines);
-
-        //Speed debug
-        //sf::Vertex lineV[] =
-        //{
-        //    sf::Vertex(p.position, sf::Color::Green),
-        //    sf::Vertex(p.position + 10.0f*p.velocity, sf::Color::Green)
-        //};
-        //ioWindow.draw(lineV, 2, sf::Lines);
-
-
-        if (iModel._step > p.spawnStep && iModel._step < p.spawnStep+g_persistence*s_fps*g_ksteps_per_frame)
-        {
-            float alpha = 1.0f*(iModel._step-p.spawnStep)/(g_persistence*s_fps*g_ksteps_per_frame);
-            if (alpha < 0.25) {alpha = 4*alpha;}
-            else if (alpha > 0.25) {alpha = 1.0-(alpha-0.25)/0.75;}
-            sf::CircleShape circle(3*DOT_SIZE);  // Radius of the circle
-            sf::Color color = p.shape.getFillColor();  // Get the current color
-            color.a = alpha * 255;  // Set the alpha component
-            circle.setFillColor(color);  // Set the color with the new alpha
-            circle.setOrigin(3*DOT_SIZE, 3*DOT_SIZE);
-            circle.setPosition(p.position);
-            ioWindow.draw(circle);
+//////////////////////////////////////////////////////////////////////////////
+// Emitters of the model, a click in the world adds one with the settings of
+// s_new_emitter
+static Emitter s_new_emitter;
+static int s_burst = 600;
+
+static void drawEmitterWindow(SimulationThread& ioSimulation, const RenderSnapshot& iSnapshot) {
+    static const char* sTypeNames[kNbParticleTypes] = {"F", "A", "B", "S", "L"};
+    ImGui::Begin("Emitters");
+    ImGui::Text("Click in the world to add an emitter");
+    ImGui::InputInt("Particles", &s_new_emitter.count);
+    ImGui::InputInt("Every N steps", &s_new_emitter.period);
+    s_new_emitter.count = std::max(0, s_new_emitter.count);
+    s_new_emitter.period = std::max(1, s_new_emitter.period);
+    int shape = s_new_emitter.shape;
+    ImGui::RadioButton("Rectangle", &shape, Emitter::Rect);
+    ImGui::SameLine();
+    ImGui::RadioButton("Disc", &shape, Emitter::Disc);
+    s_new_emitter.shape = (Emitter::Shape)shape;
+    if (s_new_emitter.shape == Emitter::Rect)
+        ImGui::SliderFloat2("Half size", &s_new_emitter.halfSize.x, 0.0f, 500.0f);
+    else
+        ImGui::SliderFloat("Radius", &s_new_emitter.halfSize.x, 0.0f, 500.0f);
+    for (int t = 0; t < kNbParticleTypes; ++t) {
+        std::string label = std::string("Weight ") + sTypeNames[t];
+        ImGui::SliderFloat(label.c_str(), &s_new_emitter.mix[t], 0.0f, 1.0f);
+    }
+    // Bulk seeding in a single batch
+    ImGui::InputInt("Burst", &s_burst);
+    s_burst = std::max(0, s_burst);
+    if (ImGui::Button("Emit burst at the center")) {
+        Emitter emitter = s_new_emitter;
+        emitter.center = Vec2f(0, 0);
+        int count = s_burst;
+        ioSimulation.push([emitter, count](SimulationThread& ioSimulation) {
+            ioSimulation.model.emit(emitter, count, ioSimulation.model._step);
+        });
+    }
+
+    for (int k = 0; k < (int)iSnapshot.emitters.size(); ++k) {
+        const Emitter& emitter = iSnapshot.emitters[k];
+        ImGui::PushID(k);
+        if (ImGui::SmallButton("Remove")) {
+            ioSimulation.push([k](SimulationThread& ioSimulation) {
+                std::vector<Emitter>& emitters = ioSimulation.model.emitters;
+                if (k < (int)emitters.size())
+                    emitters.erase(emitters.begin()+k);
+            });
         }
-        ioWindow.draw(p.shape);
-        //ioWindow.draw(lineF, 2, sf::Lines);
-        //ioWindow.draw(lines);
+        ImGui::SameLine();
+        ImGui::Text("%.2f/step at (%.0f, %.0f)", emitter.rate(), emitter.center.x, emitter.center.y);
+        ImGui::PopID();
+    }
+    if (!iSnapshot.emitters.empty() && ImGui::Button("Remove all")) {
+        ioSimulation.push([](SimulationThread& ioSimulation) {
+            ioSimulation.model.emitters.clear();
+        });
+    }
+    ImGui::End();
+}
 
-        //Draw interaction radius
-        if (p.type == ParticleType::S && g_draw_s_interaction_radius) {
-            sf::CircleShape circle(g_interaction_radius);  // Radius of the circle
-            circle.setFillColor(sf::Color::Transparent);  // Set the fill color to transparent
-            circle.setOutlineThickness(0.1f);  // Set the outline thickness
-            circle.setOutlineColor(sf::Color::Green);  // Set the outline color to green
-            circle.setOrigin(g_interaction_radius, g_interaction_radius);
-            circle.setPosition(p.position);
-            ioWindow.draw(circle);
+//////////////////////////////////////////////////////////////////////////////
+// S clusters of the last analysis, the largest ones and the recent divisions
+static void drawClusterWindow(const RenderSnapshot& iSnapshot) {
+    const int kMaxListed = 16;
+    ImGui::Begin("Clusters");
+    auto inputIntParam = [](const char* iLabel, const char* iName, int iMin) {
+        if (ImGui::InputInt(iLabel, guiInt(iName))) {
+            *guiInt(iName) = std::max(iMin, *guiInt(iName));
+            sendParam(iName);
         }
+    };
+    inputIntParam("Analysis every N steps (0: off)", "cluster_interval", 0);
+    sliderParam("Contact distance", "cluster_contact", 1.0f, 20.0f);
+    inputIntParam("Minimum size", "cluster_min_size", 1);
+    if (iSnapshot.clusterStep < 0) {
+        ImGui::Text("No analysis yet");
+        ImGui::End();
+        return;
+    }
+    ImGui::Text("Step %d: %d clusters, %d closed rings", iSnapshot.clusterStep, (int)iSnapshot.clusters.size(),
+                iSnapshot.nbClosedClusters);
+    ImGui::Text("%d divisions", iSnapshot.nbDivisions);
+    for (int c = 0; c < (int)iSnapshot.clusters.size() && c < kMaxListed; ++c) {
+        const TrackedCluster& cluster = iSnapshot.clusters[c];
+        if (cluster.closed())
+            ImGui::Text("#%d: %d S, ring around %.0f, since step %d", cluster.id, cluster.size, cluster.interiorArea, cluster.firstStep);
+        else
+            ImGui::Text("#%d: %d S, since step %d", cluster.id, cluster.size, cluster.firstStep);
     }
-    ioWindow.draw(iWorldRect);
+    if (!iSnapshot.divisions.empty())
+        ImGui::Separator();
+    for (int d = (int)iSnapshot.divisions.size()-1; d >= 0; --d) {
+        const ClusterDivision& division = iSnapshot.divisions[d];
+        ImGui::Text("Step %d: #%d -> #%d (%d + %d S)", division.step, division.parent, division.child,
+                    division.parentSize, division.childSize);
+    }
+    ImGui::End();
 }
 
 // Main function
@@ -705,11 +593,20 @@ int main()
     ImGui::GetStyle().ScaleAllSizes(2.0f);
     ImGui::GetIO().FontGlobalScale = 2.0f;
 
-    // Model
-    Model myModel;
+    // Model, stepped on its own thread
+    SimulationThread simulation;
+    s_simulation = &simulation;
+    initGuiParams();
+    simulation.maxStepsPerSecond = g_max_steps_per_second;
+    const float worldWidth = *guiInt("world_width");
+    const float worldHeight = *guiInt("world_height");
+    // One F particle every 10 steps, spread as the key spawns
+    s_new_emitter = Emitter::ofType(ParticleType::F, Vec2f(0, 0), Vec2f(worldWidth/20.0f, worldHeight/20.0f), 1, 10);
+    simulation.start();
+    ParticleRenderer renderer;
 
     // Create a view with the same size as the window
-    sf::View view(sf::FloatRect(-WORLD_WIDTH/2, -WORLD_HEIGTH/2, WORLD_WIDTH, WORLD_HEIGTH));
+    sf::View view(sf::FloatRect(-worldWidth/2, -worldHeight/2, worldWidth, worldHeight));
 
     // Variables to store the state of mouse dragging
     bool isDragging = false;
@@ -717,11 +614,11 @@ int main()
     sf::Vector2i mouseDownPxPos;
 
     // Create a sf::RectangleShape with the given world size
-    sf::RectangleShape worldRect(sf::Vector2f(WORLD_WIDTH, WORLD_HEIGTH));
+    sf::RectangleShape worldRect(sf::Vector2f(worldWidth, worldHeight));
     worldRect.setOutlineThickness(4.0f); // Adjust as needed
     worldRect.setOutlineColor(sf::Color::Red);
     worldRect.setFillColor(sf::Color::Transparent);
-    worldRect.setOrigin(WORLD_WIDTH / 2.0f, WORLD_HEIGTH / 2.0f);
+    worldRect.setOrigin(worldWidth / 2.0f, worldHeight / 2.0f);
     worldRect.setPosition(0.0f, 0.0f);
 
 
@@ -729,6 +626,7 @@ int main()
     sf::Clock deltaClock;
     while (window.isOpen()) {
         // Handle events
+        ProfileScope eventsScope(Profiler::Events);
         sf::Event event;
         while (window.pollEvent(event)) {
             ImGui::SFML::ProcessEvent(event);
@@ -761,8 +659,11 @@ int main()
                         const sf::Vector2i delta = mouseDownPxPos - mouseUpPxPos;
                         int CLICK_THRESHOLD = 2;
                         if (abs(mouseDownPxPos.x - mouseUpPxPos.x) < CLICK_THRESHOLD && abs(mouseDownPxPos.y - mouseUpPxPos.y) < CLICK_THRESHOLD) {
-                            g_source = !g_source;
-                            g_source_pos = window.mapPixelToCoords(mouseUpPxPos);
+                            Emitter emitter = s_new_emitter;
+                            emitter.center = toVec2f(window.mapPixelToCoords(mouseUpPxPos));
+                            simulation.push([emitter](SimulationThread& ioSimulation) {
+                                ioSimulation.model.emitters.push_back(emitter);
+                            });
                         }
                     }
                     isDragging = false;
@@ -778,58 +679,129 @@ int main()
                 }
                 if (event.key.code == sf::Keyboard::R)
                 {
-                    for(Particle& p : myModel.particles)
-                        myModel.plug.removeParticle(p);
-                    myModel.particles.clear();
+                    simulation.push([](SimulationThread& ioSimulation) { ioSimulation.model.clear(); });
+                }
+                if (event.key.code == sf::Keyboard::C) {
+                    *guiBool("centerize") = !*guiBool("centerize");
+                    sendParam("centerize");
+                }
+                const ParticleType keyTypes[] = {ParticleType::S, ParticleType::F, ParticleType::A, ParticleType::B, ParticleType::L};
+                const sf::Keyboard::Key keys[] = {sf::Keyboard::S, sf::Keyboard::F, sf::Keyboard::A, sf::Keyboard::B, sf::Keyboard::L};
+                for (int k = 0; k < 5; ++k) {
+                    if (event.key.code == keys[k]) {
+                        ParticleType type = keyTypes[k];
+                        Vec2f origin = toVec2f(mousePxPosForSpawn);
+                        simulation.push([type, origin](SimulationThread& ioSimulation) {
+                            ioSimulation.model.spawn(type, origin, ioSimulation.model._step);
+                        });
+                    }
                 }
-                if (event.key.code == sf::Keyboard::C)
-                    g_centerize = !g_centerize;
-                if (event.key.code == sf::Keyboard::S)
-                    myModel.spawn(ParticleType::S, mousePxPosForSpawn, myModel._step);
-                if (event.key.code == sf::Keyboard::F)
-                    myModel.spawn(ParticleType::F, mousePxPosForSpawn, myModel._step);
-                if (event.key.code == sf::Keyboard::A)
-                    myModel.spawn(ParticleType::A, mousePxPosForSpawn, myModel._step);
-                if (event.key.code == sf::Keyboard::B)
-                    myModel.spawn(ParticleType::B, mousePxPosForSpawn, myModel._step);
-                if (event.key.code == sf::Keyboard::L)
-                    myModel.spawn(ParticleType::L, mousePxPosForSpawn, myModel._step);
                 break;
             }
         }
+        eventsScope.stop();
+        ProfileScope guiScope(Profiler::Gui);
         ImGui::SFML::Update(window, deltaClock.restart());
+        drawRecordingWindow(simulation, ImGui::GetIO().DeltaTime);
+
+        const RenderSnapshot& snapshot = s_replaying ? s_replay_snapshot : simulation.snapshot();
+        // A loaded checkpoint replaces the values the GUI edits
+        SimulationThread::LoadedState loadedState;
+        if (simulation.takeLoadedState(loadedState)) {
+            s_params = loadedState.params;
+            worldRect.setSize(sf::Vector2f(loadedState.worldWidth, loadedState.worldHeight));
+            worldRect.setOrigin(loadedState.worldWidth / 2.0f, loadedState.worldHeight / 2.0f);
+        }
 
         //GUI
         ImGui::Begin("Demo window");
         s_fps = 1.0f / ImGui::GetIO().DeltaTime;
         ImGui::Text("FPS: %.1f", s_fps);
-        ImGui::Text("Population: %d", myModel.particles.size());
-        if (ImGui::InputInt("Steps per frame", &g_ksteps_per_frame)) {
-            if (g_ksteps_per_frame < 1) {
-                g_ksteps_per_frame = 1;
-            }
+        ImGui::Text("Steps/s: %.0f", snapshot.stepsPerSecond);
+        ImGui::Text("Population: %d", snapshot.size());
+        if (ImGui::InputInt("Max steps/s (0: no limit)", &g_max_steps_per_second)) {
+            g_max_steps_per_second = std::max(0, g_max_steps_per_second);
+            simulation.maxStepsPerSecond = g_max_steps_per_second;
+        }
+        if (ImGui::InputInt("Threads", guiInt("nb_threads"))) {
+            *guiInt("nb_threads") = std::max(1, std::min(*guiInt("nb_threads"), 4*(int)std::thread::hardware_concurrency()));
+            sendParam("nb_threads");
+        }
+        // Brownian kicks follow it at once, emissions from the next reset
+        if (ImGui::InputInt("Seed", guiInt("seed")))
+            sendParam("seed");
+        sliderParam("dt", "dt", 0.0f, 1.0f);
+        sliderParam("Containing force", "containing_force", 0.0f, 2.0f);
+        sliderParam("Centerize", "center_force", 0.0f, 0.001f);
+        sliderParam("Brownian speed", "temp_speed", 0.0f, 1.0f);
+        sliderParam("Void viscosity", "void_viscosity", 0.99f, 1.0f);
+        sliderParam("Void torque viscosity", "void_torque_viscosity", 0.9f, 1.0f);
+        sliderParam("S interaction radius", "interaction_radius", 4.0f, 20.0f);
+        sliderParam("S force strength", "s_f_strength", 0.0f, 5.0f);
+        sliderParam("S force exp power", "s_f_exp_power", 1.0f, 5.0f);
+        sliderParam("S torque strength", "s_t_strength", 0.0f, 2.0f);
+        sliderParam("S div angle", "div_angle", 0.0, 0.4);
+        sliderParam("S force viscosity", "s_f_viscosity", 0.0, 4.0f);
+        sliderParam("S torque viscosity", "s_t_viscosity", 0.0, 4.0f);
+        sliderParam("S opposition threshold", "opposition_threshold", 0.0, 7.0f);
+        checkboxParam("Half stencil pairs", "half_stencil");
+        checkboxParam("Trig free S orientation", "complex_orientation");
+        checkboxParam("Tabulated radial kernels", "radial_tables");
+        checkboxParam("Verlet neighbour lists", "verlet_lists");
+        if (*guiBool("verlet_lists")) {
+            sliderParam("Verlet skin", "verlet_skin", 0.0f, 10.0f);
+            ImGui::Text("Lists rebuilt every %.1f steps", snapshot.stepsPerNeighbourBuild);
         }
-        ImGui::SliderFloat("dt", &g_dt, 0.0f, 1.0f);
-        ImGui::SliderFloat("Containing force", &g_containing_force, 0.0f, 2.0f);
-        ImGui::SliderFloat("Centerize", &g_center_force, 0.0f, 0.001f);
-        ImGui::SliderFloat("Brownian speed", &g_temp_speed, 0.0f, 1.0f);
-        ImGui::SliderFloat("Void viscosity", &g_void_viscosity, 0.99f, 1.0f);
-        ImGui::SliderFloat("Void torque viscosity", &g_void_torque_viscosity, 0.9f, 1.0f);
-        ImGui::SliderFloat("S interaction radius", &g_interaction_radius, 4.0f, 20.0f);
-        ImGui::SliderFloat("S force strength", &g_s_f_strength, 0.0f, 5.0f);
-        ImGui::SliderFloat("S force exp power", &g_s_f_exp_power, 1.0f, 5.0f);
-        ImGui::SliderFloat("S torque strength", &g_s_t_strength, 0.0f, 2.0f);
-        ImGui::SliderFloat("S div angle", &g_div_angle, 0.0, 0.4);
-        ImGui::SliderFloat("S force viscosity", &g_s_f_viscosity, 0.0, 4.0f);
-        ImGui::SliderFloat("S torque viscosity", &g_s_t_viscosity, 0.0, 4.0f);
-        ImGui::SliderFloat("S opposition threshold", &g_opposition_threshold, 0.0, 7.0f);
-        ImGui::Checkbox("Destroy at boundary", &g_destroy_at_boundary);
+        checkboxParam("Sparse grid (unbounded world)", "sparse_grid");
+        checkboxParam("Auto grid resolution", "auto_grid");
+        ImGui::Text("Grid %dx%d, %.1f candidates per particle", snapshot.gridNx, snapshot.gridNy,
+                    snapshot.candidatesPerParticle);
+        auto inputWorldSize = [](const char* iLabel, const char* iName) {
+            if (!ImGui::InputInt(iLabel, guiInt(iName), 10, 100))
+                return false;
+            *guiInt(iName) = std::max(10, *guiInt(iName));
+            sendParam(iName);
+            return true;
+        };
+        bool worldResized = inputWorldSize("World width", "world_width");
+        worldResized = inputWorldSize("World height", "world_height") || worldResized;
+        if (worldResized) {
+            sf::Vector2f size(*guiInt("world_width"), *guiInt("world_height"));
+            worldRect.setSize(size);
+            worldRect.setOrigin(size / 2.0f);
+        }
+        if (hasAvx2()) {
+            checkboxParam("AVX2 S-S kernel", "simd_kernel");
+        } else {
+            ImGui::Text("S-S kernel: scalar (no AVX2)");
+        }
+        checkboxParam("Destroy at boundary", "destroy_at_boundary");
         ImGui::Checkbox("Draw S Interaction Radius", &g_draw_s_interaction_radius);
+        ImGui::Checkbox("Density view when zoomed out", &g_density_view);
+        if (g_density_view)
+            ImGui::SliderInt("Below pixels per cell", &g_density_cell_pixels, 1, 32);
+        if (renderer.densityDrawn)
+            ImGui::Text("Density of %d particles, %dx%d texels", renderer.nbDrawn, renderer.densityWidth, renderer.densityHeight);
+        else
+            ImGui::Text("Drawn %d particles in %d cells", renderer.nbDrawn, renderer.nbCellsDrawn);
         ImGui::Checkbox("Spawn particules at mouse location", &g_spawn_at_mouse_location);
         ImGui::Text("S,F,A,B key to spawn particles");
         ImGui::Text("C key to center");
         ImGui::Text("R key to reset");
+        ImGui::InputText("Checkpoint", s_checkpoint_path, sizeof(s_checkpoint_path));
+        if (ImGui::Button("Save"))
+            simulation.saveCheckpoint(s_checkpoint_path);
+        ImGui::SameLine();
+        if (ImGui::Button("Load"))
+            simulation.loadCheckpoint(s_checkpoint_path);
+        ImGui::Text("%s", simulation.checkpointStatus().c_str());
         ImGui::End();
+        drawProfilerWindow();
+        if (!s_replaying) {
+            drawEmitterWindow(simulation, snapshot);
+            drawClusterWindow(snapshot);
+        }
+        guiScope.stop();
 
         // Check for mouse dragging
         if (isDragging && sf::Mouse::isButtonPressed(sf::Mouse::Left)) {
@@ -845,27 +817,23 @@ int main()
         // Update the last mouse position
         lastMousePos = window.mapPixelToCoords(sf::Mouse::getPosition(window));
 
-        // Spawning
-        if (g_source)
-        {
-            myModel.spawn(ParticleType::F, g_source_pos, myModel._step);
-        }
-
-        // Model update
-        for (int i=0; i<g_ksteps_per_frame; ++i)
-            myModel.step();
-
         // Clear screen
+        ProfileScope drawScope(Profiler::Draw);
         window.clear();
 
         // Draw particles
-        drawModel(window, worldRect, myModel);
+        renderer.draw(window, worldRect, snapshot);
         ImGui::SFML::Render(window);
+        drawScope.stop();
 
         // Update the window
+        ProfileScope displayScope(Profiler::Display);
         window.display();
+        displayScope.stop();
+        g_profiler.endFrame();
     }
 
+    simulation.stop();
     ImGui::SFML::Shutdown();
 
     return 0;
@@ -0,0 +1,79 @@
+#pragma once
+#include "Vec2.h"
+#include <cstdint>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Open addressing hash table from integer cell coordinates to an index,
+// linear probing, at most half full. Memory follows the number of keys,
+// coordinates can be anything in the int range.
+struct CellHash {
+    static const int64_t kEmpty = INT64_MIN;
+
+    std::vector<int64_t> keys;
+    std::vector<int> values;
+    int nbKeys = 0;
+    uint64_t mask = 0;
+
+    static int64_t key(int i, int j) {
+        return (int64_t)(((uint64_t)(uint32_t)j << 32) | (uint32_t)i);
+    }
+    int slotOf(int64_t iKey) const {
+        // Fibonacci hashing mixes the row and column bits
+        return (int)((((uint64_t)iKey) * 0x9E3779B97F4A7C15ull >> 32) & mask);
+    }
+    // Empties the table, sized for iNbKeys keys
+    void reset(int iNbKeys) {
+        size_t capacity = 16;
+        while (capacity < 2*(size_t)iNbKeys)
+            capacity *= 2;
+        keys.assign(capacity, int64_t(kEmpty));
+        values.resize(capacity);
+        mask = capacity-1;
+        nbKeys = 0;
+    }
+    // Index of iKey, inserted with iValue when missing
+    int insert(int64_t iKey, int iValue) {
+        if (2*(nbKeys+1) > (int)keys.size())
+            grow();
+        for (int s = slotOf(iKey);; s = (s+1) & mask) {
+            if (keys[s] == iKey)
+                return values[s];
+            if (keys[s] == kEmpty) {
+                keys[s] = iKey;
+                values[s] = iValue;
+                ++nbKeys;
+                return iValue;
+            }
+        }
+    }
+    // -1 when missing
+    int find(int64_t iKey) const {
+        if (keys.empty())
+            return -1;
+        for (int s = slotOf(iKey);; s = (s+1) & mask) {
+            if (keys[s] == iKey)
+                return values[s];
+            if (keys[s] == kEmpty)
+                return -1;
+        }
+    }
+    // values[s] becomes iMap[values[s]]
+    void remap(const std::vector<int>& iMap) {
+        for (size_t s = 0; s < keys.size(); ++s)
+            if (keys[s] != kEmpty)
+                values[s] = iMap[values[s]];
+    }
+
+private:
+    void grow() {
+        std::vector<int64_t> oldKeys;
+        std::vector<int> oldValues;
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        reset(2*nbKeys+2);
+        for (size_t s = 0; s < oldKeys.size(); ++s)
+            if (oldKeys[s] != kEmpty)
+                insert(oldKeys[s], oldValues[s]);
+    }
+};
@@ -0,0 +1,251 @@
+#include "Checkpoint.h"
+#include "MappedFile.h"
+#include "Params.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+
+static const char kMagic[8] = {'P', 'L', 'I', 'F', 'E', 'C', 'K', 'P'};
+static const uint32_t kVersion = 2;
+static const size_t kAlignment = 64;
+
+static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header layout");
+static_assert(sizeof(Vec2f) == 2*sizeof(float) && std::is_trivially_copyable<Vec2f>::value,
+              "Vec2f arrays are saved as raw memory");
+
+static size_t alignUp(size_t iOffset) {
+    return (iOffset + kAlignment-1) / kAlignment * kAlignment;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Sequential writer keeping track of the offset for the array alignment
+struct CheckpointWriter {
+    std::ofstream file;
+    size_t offset = 0;
+
+    void write(const void* iData, size_t iSize) {
+        file.write((const char*)iData, iSize);
+        offset += iSize;
+    }
+    void align() {
+        static const char zeros[kAlignment] = {};
+        write(zeros, alignUp(offset) - offset);
+    }
+    template <typename T>
+    void writeArray(const std::vector<T>& iArray) {
+        align();
+        write(iArray.data(), iArray.size()*sizeof(T));
+    }
+};
+
+// Bounds checked reader over the mapping
+struct CheckpointReader {
+    const char* data;
+    size_t size;
+    size_t offset = 0;
+
+    // Pointer to the next iSize bytes, nullptr past the end of the file
+    const char* take(size_t iSize) {
+        if (iSize > size - offset)
+            return nullptr;
+        const char* p = data + offset;
+        offset += iSize;
+        return p;
+    }
+    bool read(void* oData, size_t iSize) {
+        const char* p = take(iSize);
+        if (p)
+            std::memcpy(oData, p, iSize);
+        return p != nullptr;
+    }
+    template <typename T>
+    const char* takeArray(int n) {
+        offset = std::min(alignUp(offset), size);
+        return take(n*sizeof(T));
+    }
+};
+
+template <typename T>
+static void copyArray(const char* iData, int n, std::vector<T>& oArray) {
+    oArray.resize(n);
+    if (n > 0)
+        std::memcpy(oArray.data(), iData, n*sizeof(T));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool saveCheckpoint(const std::string& iPath, const Model& iModel, std::string& oError) {
+    const ParticleStore& particles = iModel.particles;
+    std::string params;
+    for (const Param& param : getParams()) {
+        params += (char)std::strlen(param.name);
+        params += param.name;
+        params += (char)param.kind;
+        ParamValue value = param.get(iModel.config);
+        params.append((const char*)&value, 4);
+    }
+    std::ostringstream rng;
+    rng << iModel.gen;
+
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.nbParticles = particles.size();
+    header.step = iModel._step;
+    header.worldWidth = iModel.config.world_width;
+    header.worldHeight = iModel.config.world_height;
+    header.gridNx = iModel.plug.nbCellsX;
+    header.gridNy = iModel.plug.nbCellsY;
+    header.gridOccupied = iModel.plug.nbOccupied;
+    header.headingInSync = iModel.headingInSync;
+    header.nbEmitters = (int32_t)iModel.emitters.size();
+    header.paramsSize = (uint32_t)params.size();
+    header.rngSize = (uint32_t)rng.str().size();
+
+    std::vector<uint8_t> types(particles.type.begin(), particles.type.end());
+
+    CheckpointWriter writer;
+    writer.file.open(iPath, std::ios::binary | std::ios::trunc);
+    if (!writer.file) {
+        oError = "cannot write " + iPath;
+        return false;
+    }
+    writer.write(&header, sizeof(header));
+    writer.write(params.data(), params.size());
+    writer.write(rng.str().data(), rng.str().size());
+    writer.writeArray(particles.position);
+    writer.writeArray(particles.velocity);
+    writer.writeArray(particles.orientation);
+    writer.writeArray(particles.heading);
+    writer.writeArray(particles.angularVelocity);
+    writer.writeArray(types);
+    writer.writeArray(particles.spawnStep);
+    writer.writeArray(iModel.emitters);
+    writer.file.close();
+    if (!writer.file) {
+        oError = "error while writing " + iPath;
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool loadCheckpoint(const std::string& iPath, Model& ioModel, std::string& oError) {
+    MappedFile mapped;
+    if (!mapped.open(iPath)) {
+        oError = "cannot open " + iPath;
+        return false;
+    }
+    CheckpointReader reader = {mapped.data, mapped.size};
+    CheckpointHeader header;
+    if (!reader.read(&header, sizeof(header)) || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        oError = iPath + " is not a checkpoint";
+        return false;
+    }
+    if (header.version != kVersion) {
+        oError = iPath + ": unsupported checkpoint version " + std::to_string(header.version);
+        return false;
+    }
+    if (header.nbParticles < 0 || header.worldWidth <= 0 || header.worldHeight <= 0
+        || header.gridNx <= 0 || header.gridNy <= 0 || header.nbEmitters < 0) {
+        oError = iPath + ": invalid header";
+        return false;
+    }
+
+    // Everything is checked before the model is modified
+    struct LoadedParam {
+        Param* param;
+        ParamValue value;
+    };
+    std::vector<LoadedParam> loadedParams;
+    CheckpointReader paramReader = {reader.take(header.paramsSize), header.paramsSize};
+    if (!paramReader.data) {
+        oError = iPath + ": truncated file";
+        return false;
+    }
+    while (paramReader.offset < paramReader.size) {
+        uint8_t nameLength = 0;
+        uint8_t kind = 0;
+        ParamValue value;
+        paramReader.read(&nameLength, 1);
+        const char* name = paramReader.take(nameLength);
+        if (!name || !paramReader.read(&kind, 1) || !paramReader.read(&value, 4)) {
+            oError = iPath + ": invalid parameters";
+            return false;
+        }
+        // The thread count is a setting of the machine, not of the simulation
+        Param* param = findParam(std::string(name, nameLength));
+        if (param && param->kind == kind && param->offset != offsetof(ModelConfig, nb_threads))
+            loadedParams.push_back(LoadedParam{param, value});
+    }
+    const char* rngText = reader.take(header.rngSize);
+    std::mt19937 gen;
+    std::istringstream rng(std::string(rngText ? rngText : "", rngText ? header.rngSize : 0));
+    if (!(rng >> gen)) {
+        oError = iPath + ": invalid random generator state";
+        return false;
+    }
+
+    int n = header.nbParticles;
+    const char* position = reader.takeArray<Vec2f>(n);
+    const char* velocity = reader.takeArray<Vec2f>(n);
+    const char* orientation = reader.takeArray<float>(n);
+    const char* heading = reader.takeArray<Vec2f>(n);
+    const char* angularVelocity = reader.takeArray<float>(n);
+    const char* type = reader.takeArray<uint8_t>(n);
+    const char* spawnStep = reader.takeArray<int>(n);
+    const char* emitters = reader.takeArray<Emitter>(header.nbEmitters);
+    if (!spawnStep || !position || !velocity || !orientation || !heading || !angularVelocity || !type
+        || !emitters) {
+        oError = iPath + ": truncated file";
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        if ((uint8_t)type[i] > ParticleType::L) {
+            oError = iPath + ": invalid particle type";
+            return false;
+        }
+    }
+    std::vector<Emitter> loadedEmitters;
+    copyArray(emitters, header.nbEmitters, loadedEmitters);
+    for (const Emitter& emitter : loadedEmitters) {
+        if (emitter.count < 0 || emitter.period <= 0 || (emitter.shape != Emitter::Rect && emitter.shape != Emitter::Disc)) {
+            oError = iPath + ": invalid emitter";
+            return false;
+        }
+    }
+
+    ModelConfig& config = ioModel.config;
+    for (const LoadedParam& loaded : loadedParams)
+        loaded.param->set(config, loaded.value);
+    config.world_width = header.worldWidth;
+    config.world_height = header.worldHeight;
+    ioModel.plug.configure(config);
+    ioModel.plug.setResolution(header.gridNx, header.gridNy);
+
+    ParticleStore& particles = ioModel.particles;
+    copyArray(position, n, particles.position);
+    copyArray(velocity, n, particles.velocity);
+    copyArray(orientation, n, particles.orientation);
+    copyArray(heading, n, particles.heading);
+    copyArray(angularVelocity, n, particles.angularVelocity);
+    copyArray(spawnStep, n, particles.spawnStep);
+    particles.type.resize(n);
+    for (int i = 0; i < n; ++i)
+        particles.type[i] = (ParticleType)type[i];
+    particles.force.assign(n, Vec2f(0.0, 0.0));
+    particles.torque.assign(n, 0.0f);
+    particles.cluster.assign(n, -1);
+    ioModel._step = header.step;
+    ioModel.gen = gen;
+    ioModel.headingInSync = header.headingInSync != 0;
+    ioModel.plug.clear();
+    ioModel.plug.nbOccupied = std::max(0, header.gridOccupied);
+    ioModel.verletLists.invalidate();
+    ioModel.clusters.reset(); // ids start over, the analysis state is not saved
+    ioModel.emitters = loadedEmitters;
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "Model.h"
+#include "Vec2.h"
+#include <cstdint>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////
+// Binary checkpoint of the whole simulation state: the particles, the step,
+// the random generator, the emitters, the world and grid sizes and every
+// parameter of the model config, see getParams(). Native byte order, layout:
+//   CheckpointHeader                  64 bytes, magic and version first
+//   parameters                        per parameter: name length (1 byte),
+//                                     name, kind (1 byte), value (4 bytes)
+//   random generator state            std::mt19937 as text
+//   position velocity orientation     one array per field, each at an offset
+//   heading angularVelocity type      aligned on 64 bytes, type on one byte
+//   spawnStep
+//   emitters                          Emitter structures
+// Forces and torques are not saved, the next step computes them again.
+// The file is written in a single sequential pass. It is memory mapped to
+// load, the arrays are copied straight from the mapping into the store.
+// Parameters unknown to this build are skipped, missing ones keep their value,
+// and so does nb_threads which depends on the machine, not on the simulation.
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t nbParticles;
+    int32_t step;
+    int32_t worldWidth;
+    int32_t worldHeight;
+    int32_t gridNx;
+    int32_t gridNy;
+    uint8_t headingInSync;
+    uint8_t padding[3];
+    int32_t nbEmitters;
+    uint32_t reserved[2];
+    uint32_t paramsSize; // bytes
+    uint32_t rngSize; // bytes
+    int32_t gridOccupied; // occupied cells at the last rebuild, for Plug::updateGrid()
+};
+
+// False with a message in oError, the model is left untouched when loading fails
+bool saveCheckpoint(const std::string& iPath, const Model& iModel, std::string& oError);
+bool loadCheckpoint(const std::string& iPath, Model& ioModel, std::string& oError);
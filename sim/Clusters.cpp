@@ -0,0 +1,216 @@
+#include "Clusters.h"
+#include <algorithm>
+#include <cmath>
+
+//////////////////////////////////////////////////////////////////////////////
+void ClusterTracker::update(ParticleStore& ioParticles, const Plug& iPlug, const ModelConfig& iConfig, int iStep) {
+    float contact = std::min(iConfig.cluster_contact, iConfig.interaction_radius);
+    int minSize = std::max(1, iConfig.cluster_min_size);
+    const std::vector<ParticleType>& type = ioParticles.type;
+    const std::vector<Vec2f>& position = ioParticles.position;
+    int n = ioParticles.size();
+    joinContacts(ioParticles, iPlug, contact);
+
+    // Groups of at least minSize particles, numbered in index order, and
+    // their particles grouped by cluster
+    rootCluster.assign(n, -1);
+    int nbClusters = 0;
+    for (int p = 0; p < n; ++p) {
+        int root = sets.find(p);
+        if (type[p] == ParticleType::S && sets.size[root] >= minSize && rootCluster[root] < 0)
+            rootCluster[root] = nbClusters++;
+    }
+    memberStart.assign(nbClusters+1, 0);
+    for (int p = 0; p < n; ++p)
+        if (type[p] == ParticleType::S && rootCluster[sets.find(p)] >= 0)
+            ++memberStart[rootCluster[sets.find(p)]+1];
+    std::partial_sum(memberStart.begin(), memberStart.end(), memberStart.begin());
+    members.resize(memberStart.back());
+    std::vector<int> cursor(memberStart.begin(), memberStart.end()-1);
+    for (int p = 0; p < n; ++p)
+        if (type[p] == ParticleType::S && rootCluster[sets.find(p)] >= 0)
+            members[cursor[rootCluster[sets.find(p)]]++] = p;
+
+    std::vector<TrackedCluster> previous;
+    previous.swap(clusters);
+    clusters.resize(nbClusters);
+    for (int c = 0; c < nbClusters; ++c) {
+        TrackedCluster& cluster = clusters[c];
+        cluster.id = -1;
+        cluster.size = memberStart[c+1]-memberStart[c];
+        cluster.center = Vec2f(0.0f, 0.0f);
+        for (int m = memberStart[c]; m < memberStart[c+1]; ++m)
+            cluster.center += position[members[m]];
+        cluster.center = cluster.center * (1.0f/cluster.size);
+        cluster.interiorArea = getInteriorArea(ioParticles, c, contact);
+        cluster.firstStep = iStep;
+        cluster.parent = -1;
+    }
+    matchPrevious(ioParticles, previous, minSize, iStep);
+
+    nbClosed = (int)std::count_if(clusters.begin(), clusters.end(), [](const TrackedCluster& iCluster) {
+        return iCluster.closed();
+    });
+    std::sort(clusters.begin(), clusters.end(), [](const TrackedCluster& iA, const TrackedCluster& iB) {
+        return iA.size != iB.size ? iA.size > iB.size : iA.id < iB.id;
+    });
+    step = iStep;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ClusterTracker::joinContacts(const ParticleStore& iParticles, const Plug& iPlug, float iContact) {
+    const std::vector<Vec2f>& position = iParticles.position;
+    float contact2 = iContact*iContact;
+    sets.reset(iParticles.size());
+    for (int p = 0; p < iParticles.size(); ++p) {
+        if (iParticles.type[p] != ParticleType::S)
+            continue;
+        iPlug.forEachNeighbourOfTypes(position[p], 1u << ParticleType::S, [&](int other, ParticleType) {
+            Vec2f r = position[other] - position[p];
+            if (other > p && r.x*r.x + r.y*r.y < contact2)
+                sets.unite(p, other);
+        });
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Overlaps are the particles a new cluster shares with a previous one, from
+// the ids left in ParticleStore::cluster by the previous analysis
+void ClusterTracker::matchPrevious(ParticleStore& ioParticles, std::vector<TrackedCluster>& ioPrevious,
+                                   int iMinSize, int iStep) {
+    std::vector<int>& label = ioParticles.cluster;
+    int nbClusters = (int)clusters.size();
+    overlaps.clear();
+    for (int c = 0; c < nbClusters; ++c)
+        for (int m = memberStart[c]; m < memberStart[c+1]; ++m)
+            if (label[members[m]] >= 0)
+                overlaps.push_back(Overlap{c, label[members[m]], 1});
+    std::sort(overlaps.begin(), overlaps.end(), [](const Overlap& iA, const Overlap& iB) {
+        return iA.cluster != iB.cluster ? iA.cluster < iB.cluster : iA.previous < iB.previous;
+    });
+    int nbOverlaps = 0;
+    for (const Overlap& overlap : overlaps) {
+        if (nbOverlaps > 0 && overlaps[nbOverlaps-1].cluster == overlap.cluster && overlaps[nbOverlaps-1].previous == overlap.previous)
+            ++overlaps[nbOverlaps-1].count;
+        else
+            overlaps[nbOverlaps++] = overlap;
+    }
+    overlaps.resize(nbOverlaps);
+
+    // Main origin of every new cluster, the smaller id on ties
+    std::vector<int> origin(nbClusters, -1);
+    std::vector<int> originCount(nbClusters, 0);
+    for (const Overlap& overlap : overlaps) {
+        if (overlap.count > originCount[overlap.cluster]) {
+            origin[overlap.cluster] = overlap.previous;
+            originCount[overlap.cluster] = overlap.count;
+        }
+    }
+
+    // Pieces of every previous cluster, largest first
+    std::sort(overlaps.begin(), overlaps.end(), [](const Overlap& iA, const Overlap& iB) {
+        if (iA.previous != iB.previous)
+            return iA.previous < iB.previous;
+        return iA.count != iB.count ? iA.count > iB.count : iA.cluster < iB.cluster;
+    });
+    std::sort(ioPrevious.begin(), ioPrevious.end(), [](const TrackedCluster& iA, const TrackedCluster& iB) {
+        return iA.id < iB.id;
+    });
+    for (int first = 0, last = 0; first < nbOverlaps; first = last) {
+        int id = overlaps[first].previous;
+        for (last = first+1; last < nbOverlaps && overlaps[last].previous == id; ++last) {}
+        TrackedCluster& largest = clusters[overlaps[first].cluster];
+        if (origin[overlaps[first].cluster] != id)
+            continue;
+        largest.id = id;
+        std::vector<TrackedCluster>::iterator before = std::lower_bound(ioPrevious.begin(), ioPrevious.end(), id,
+            [](const TrackedCluster& iCluster, int iId) {
+                return iCluster.id < iId;
+            });
+        if (before != ioPrevious.end() && before->id == id) {
+            largest.firstStep = before->firstStep;
+            largest.parent = before->parent;
+        }
+        for (int o = first+1; o < last; ++o) {
+            TrackedCluster& piece = clusters[overlaps[o].cluster];
+            if (origin[overlaps[o].cluster] != id || overlaps[o].count < iMinSize)
+                continue;
+            piece.id = nextId++;
+            piece.parent = id;
+            divisions.push_back(ClusterDivision{iStep, id, piece.id, largest.size, piece.size});
+            ++nbDivisions;
+        }
+    }
+    if ((int)divisions.size() > kNbRecentDivisions)
+        divisions.erase(divisions.begin(), divisions.end()-kNbRecentDivisions);
+
+    for (TrackedCluster& cluster : clusters)
+        if (cluster.id < 0)
+            cluster.id = nextId++;
+    std::fill(label.begin(), label.end(), -1);
+    for (int c = 0; c < nbClusters; ++c)
+        for (int m = memberStart[c]; m < memberStart[c+1]; ++m)
+            label[members[m]] = clusters[c].id;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Raster cells of half the contact. A particle covers the cells whose center is
+// within half the contact plus half a cell diagonal: every cell the segment to
+// a linked particle crosses, or touches at a corner, is covered, so the outside
+// fill (4 neighbours) cannot cross a ring.
+float ClusterTracker::getInteriorArea(const ParticleStore& iParticles, int iCluster, float iContact) {
+    const long long kMaxRasterCells = 1 << 22;
+    const std::vector<Vec2f>& position = iParticles.position;
+    float h = 0.5f*iContact;
+    float stamp = 0.5f*iContact + 0.71f*h;
+    Vec2f low = position[members[memberStart[iCluster]]];
+    Vec2f high = low;
+    for (int m = memberStart[iCluster]; m < memberStart[iCluster+1]; ++m) {
+        const Vec2f& pos = position[members[m]];
+        low = Vec2f(std::min(low.x, pos.x), std::min(low.y, pos.y));
+        high = Vec2f(std::max(high.x, pos.x), std::max(high.y, pos.y));
+    }
+    int pad = (int)std::ceil(stamp/h)+1;
+    int nx = (int)((high.x-low.x)/h) + 2*pad + 1;
+    int ny = (int)((high.y-low.y)/h) + 2*pad + 1;
+    if ((long long)nx*ny > kMaxRasterCells)
+        return 0.0f;
+    Vec2f origin(low.x - pad*h, low.y - pad*h);
+    enum { Free, Covered, Outside };
+    raster.assign(nx*ny, Free);
+    for (int m = memberStart[iCluster]; m < memberStart[iCluster+1]; ++m) {
+        Vec2f pos = position[members[m]] - origin;
+        int i0 = (int)((pos.x-stamp)/h);
+        int i1 = (int)((pos.x+stamp)/h);
+        int j0 = (int)((pos.y-stamp)/h);
+        int j1 = (int)((pos.y+stamp)/h);
+        for (int j = j0; j <= j1; ++j) {
+            for (int i = i0; i <= i1; ++i) {
+                float dx = (i+0.5f)*h - pos.x;
+                float dy = (j+0.5f)*h - pos.y;
+                if (dx*dx + dy*dy <= stamp*stamp)
+                    raster[nx*j+i] = Covered;
+            }
+        }
+    }
+
+    // The padding keeps the corner outside
+    fillStack.assign(1, 0);
+    raster[0] = Outside;
+    while (!fillStack.empty()) {
+        int k = fillStack.back();
+        fillStack.pop_back();
+        int i = k % nx;
+        int j = k / nx;
+        int next[4] = {i > 0 ? k-1 : -1, i < nx-1 ? k+1 : -1, j > 0 ? k-nx : -1, j < ny-1 ? k+nx : -1};
+        for (int l : next) {
+            if (l >= 0 && raster[l] == Free) {
+                raster[l] = Outside;
+                fillStack.push_back(l);
+            }
+        }
+    }
+    float area = std::count(raster.begin(), raster.end(), (char)Free)*h*h;
+    float minArea = 0.25f*(float)M_PI*iContact*iContact;
+    return area >= minArea ? area : 0.0f;
+}
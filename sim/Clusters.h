@@ -0,0 +1,124 @@
+#pragma once
+#include "Params.h"
+#include "ParticleStore.h"
+#include "Plug.h"
+#include "Vec2.h"
+#include <numeric>
+#include <utility>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Disjoint sets of indices, union by size with path halving
+struct UnionFind {
+    std::vector<int> parent;
+    std::vector<int> size;
+
+    void reset(int iCount) {
+        parent.resize(iCount);
+        std::iota(parent.begin(), parent.end(), 0);
+        size.assign(iCount, 1);
+    }
+    int find(int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+    // False when a and b were already in the same set
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+            return false;
+        if (size[a] < size[b])
+            std::swap(a, b);
+        parent[b] = a;
+        size[a] += size[b];
+        return true;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Group of S particles linked by contacts, followed from one analysis to the next
+struct TrackedCluster {
+    int id;
+    int size;
+    Vec2f center; // mean position
+    float interiorArea; // free area enclosed by the group, 0 when it is not a closed ring
+    int firstStep; // analysis where the id appeared
+    int parent; // id of the cluster it split from, -1 when it did not
+
+    bool closed() const {
+        return interiorArea > 0.0f;
+    }
+};
+
+// Split of cluster parent: its largest piece keeps the id, child is a new piece
+struct ClusterDivision {
+    int step;
+    int parent;
+    int child;
+    int parentSize; // after the split
+    int childSize;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// S clusters analysed every config.cluster_interval steps by Model::step():
+// - the S particles closer than config.cluster_contact are joined in a
+//   union-find, the contacts are searched in the plug cells, that cover the
+//   interaction radius: the contact is capped to it. Groups of less than
+//   config.cluster_min_size particles are ignored.
+// - a group is a closed ring when it encloses free space: its particles are
+//   stamped as disks of half the contact on a raster of its bounding box, the
+//   outside is flood filled and what is left is the interior. Linked particles
+//   always give connected disks so a ring cannot leak. Holes smaller than a
+//   disk of the contact diameter are ignored.
+// - the id of every particle's cluster stays in ParticleStore::cluster, that
+//   follows the particles through erase. A group takes the id of the previous
+//   cluster most of its particles come from when it is the largest piece of
+//   it, otherwise it gets a new id. The other pieces of at least the minimum
+//   size are divisions.
+// Only per cluster data is kept, the particles are not copied.
+struct ClusterTracker {
+    static const int kNbRecentDivisions = 32;
+    std::vector<TrackedCluster> clusters; // of the last analysis, decreasing size
+    std::vector<ClusterDivision> divisions; // the last kNbRecentDivisions, oldest first
+    int nbDivisions = 0; // since the last reset
+    int nbClosed = 0; // closed rings of the last analysis
+    int step = -1; // of the last analysis
+    int nextId = 0;
+
+    struct Overlap {
+        int cluster; // of the new analysis
+        int previous; // id
+        int count;
+    };
+    UnionFind sets;
+    std::vector<int> rootCluster; // cluster of each set root, -1 for none
+    std::vector<int> memberStart; // particles of cluster c: members[memberStart[c]] to [memberStart[c+1]-1]
+    std::vector<int> members;
+    std::vector<Overlap> overlaps;
+    std::vector<char> raster;
+    std::vector<int> fillStack;
+
+    void reset() {
+        clusters.clear();
+        divisions.clear();
+        nbDivisions = 0;
+        nbClosed = 0;
+        step = -1;
+        nextId = 0;
+    }
+    // Analysis of the particles at iStep, from a plug rebuilt on their
+    // current positions. Writes ioParticles.cluster.
+    void update(ParticleStore& ioParticles, const Plug& iPlug, const ModelConfig& iConfig, int iStep);
+    int largestSize() const {
+        return clusters.empty() ? 0 : clusters.front().size;
+    }
+
+private:
+    void joinContacts(const ParticleStore& iParticles, const Plug& iPlug, float iContact);
+    void matchPrevious(ParticleStore& ioParticles, std::vector<TrackedCluster>& ioPrevious, int iMinSize, int iStep);
+    float getInteriorArea(const ParticleStore& iParticles, int iCluster, float iContact);
+};
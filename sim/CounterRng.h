@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+//////////////////////////////////////////////////////////////////////////////
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"): four random words that are a bijection of a
+// 128 bit counter under a 64 bit key, without any state. Draws keyed on
+// (seed, stream) and counted by (particle, step) are the same whatever the
+// thread or the order they are made in.
+struct Philox4x32 {
+    uint32_t word[4];
+
+    Philox4x32(uint32_t iKey0, uint32_t iKey1, uint32_t iCounter0, uint32_t iCounter1,
+               uint32_t iCounter2 = 0, uint32_t iCounter3 = 0) {
+        const uint32_t kMultiplier0 = 0xD2511F53;
+        const uint32_t kMultiplier1 = 0xCD9E8D57;
+        const uint32_t kWeyl0 = 0x9E3779B9;
+        const uint32_t kWeyl1 = 0xBB67AE85;
+        uint32_t x0 = iCounter0, x1 = iCounter1, x2 = iCounter2, x3 = iCounter3;
+        uint32_t k0 = iKey0, k1 = iKey1;
+        for (int round = 0; round < 10; ++round) {
+            uint64_t product0 = (uint64_t)kMultiplier0*x0;
+            uint64_t product1 = (uint64_t)kMultiplier1*x2;
+            x0 = (uint32_t)(product1 >> 32) ^ x1 ^ k0;
+            x1 = (uint32_t)product1;
+            x2 = (uint32_t)(product0 >> 32) ^ x3 ^ k1;
+            x3 = (uint32_t)product0;
+            k0 += kWeyl0;
+            k1 += kWeyl1;
+        }
+        word[0] = x0;
+        word[1] = x1;
+        word[2] = x2;
+        word[3] = x3;
+    }
+
+    // Word k as a float in [0,1), 24 bits of it
+    float uniform(int k) const {
+        return (word[k] >> 8)*(1.0f/16777216.0f);
+    }
+    // Word k as a float in [iMin,iMax)
+    float uniform(int k, float iMin, float iMax) const {
+        return iMin + (iMax-iMin)*uniform(k);
+    }
+};
+
+// Streams of the model, the second key word: one per use so that they never
+// share draws
+enum RngStream : uint32_t {
+    BrownianStream = 1
+};
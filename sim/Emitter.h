@@ -0,0 +1,47 @@
+#pragma once
+#include "ParticleStore.h"
+#include "Vec2.h"
+#include <cstdint>
+#include <type_traits>
+
+//////////////////////////////////////////////////////////////////////////////
+// Source of particles run at the start of Model::step(): count particles every
+// period steps, spread evenly over the steps, drawn uniformly over a rectangle
+// or a disc with their type drawn from mix. What a step emits only depends on
+// the step, an emitter carries no state from one step to the next.
+struct Emitter {
+    enum Shape : int32_t { Rect, Disc };
+
+    Vec2f center;
+    Vec2f halfSize; // Rect half width and height, Disc radius in x
+    Shape shape = Rect;
+    int32_t count = 1;
+    int32_t period = 1;
+    float mix[kNbParticleTypes] = {}; // Relative weight of each type
+
+    // Particles per step
+    float rate() const {
+        return (float)count/period;
+    }
+    // ceil(count*s/period) particles are emitted before step s
+    int countAt(int iStep) const {
+        auto emittedBefore = [this](long long s) {
+            return (count*s + period-1)/period;
+        };
+        return (int)(emittedBefore(iStep+1) - emittedBefore(iStep));
+    }
+    // Particles of type iType only
+    static Emitter ofType(ParticleType iType, const Vec2f& iCenter, const Vec2f& iHalfSize,
+                          int iCount = 1, int iPeriod = 1) {
+        Emitter emitter;
+        emitter.center = iCenter;
+        emitter.halfSize = iHalfSize;
+        emitter.count = iCount;
+        emitter.period = iPeriod;
+        emitter.mix[iType] = 1.0f;
+        return emitter;
+    }
+};
+
+// Saved as raw memory in checkpoints
+static_assert(std::is_trivially_copyable<Emitter>::value, "Emitter is copied as raw memory");
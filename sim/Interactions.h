@@ -0,0 +1,89 @@
+#pragma once
+#include "ParticleStore.h"
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////////////
+// What happens between a particle of type A and one of type B, declared by
+// specialising PairForceOf and ReactionOf below. The pair loops look the
+// types up in kPairTable, built from the specialisations at compile time,
+// instead of comparing types, and skip the pairs that do nothing before
+// computing their distance.
+// Forces act within the interaction radius, reactions within reactionRadius().
+
+// Force kernel of a pair, seen from its first particle p
+enum PairForce {
+    NoForce,
+    PolarForce, // S-S vesicle model
+    WallForce, // p is S, the other particle an A, B or L wall
+    WalledForce // p is an A, B or L wall, the other particle S
+};
+
+template<ParticleType A, ParticleType B> struct PairForceOf { static const PairForce value = NoForce; };
+template<> struct PairForceOf<S, S> { static const PairForce value = PolarForce; };
+template<> struct PairForceOf<S, A> { static const PairForce value = WallForce; };
+template<> struct PairForceOf<S, B> { static const PairForce value = WallForce; };
+template<> struct PairForceOf<S, L> { static const PairForce value = WallForce; };
+template<> struct PairForceOf<A, S> { static const PairForce value = WalledForce; };
+template<> struct PairForceOf<B, S> { static const PairForce value = WalledForce; };
+template<> struct PairForceOf<L, S> { static const PairForce value = WalledForce; };
+
+// A + B makes productA + productB
+template<ParticleType A, ParticleType B> struct ReactionOf {
+    static const bool value = false;
+    static const ParticleType productA = A;
+    static const ParticleType productB = B;
+};
+template<ParticleType ProductA, ParticleType ProductB> struct Products {
+    static const bool value = true;
+    static const ParticleType productA = ProductA;
+    static const ParticleType productB = ProductB;
+};
+//Chemical force 1: F makes B when catalysed by A
+template<> struct ReactionOf<F, A> : Products<B, A> {};
+template<> struct ReactionOf<A, F> : Products<A, B> {};
+//Chemical force 2: F + B makes A + S, the B turns back into the catalyst
+template<> struct ReactionOf<F, B> : Products<S, A> {};
+template<> struct ReactionOf<B, F> : Products<A, S> {};
+//Chemical force 3: R + A makes R + F // Test reaction limitor
+template<> struct ReactionOf<L, A> : Products<F, L> {};
+template<> struct ReactionOf<A, L> : Products<L, F> {};
+
+//////////////////////////////////////////////////////////////////////////////
+struct PairInteraction {
+    PairForce force;
+    bool reacts;
+    ParticleType productA;
+    ParticleType productB;
+};
+
+struct PairTable {
+    PairInteraction entries[kNbParticleTypes*kNbParticleTypes]; // [A*kNbParticleTypes+B]
+    // Per type A, bit B set when A and B have a force, or react
+    unsigned forceMask[kNbParticleTypes];
+    unsigned reactMask[kNbParticleTypes];
+};
+
+template<int A, int B>
+constexpr PairInteraction makePairInteraction() {
+    typedef PairForceOf<(ParticleType)A, (ParticleType)B> Force;
+    typedef ReactionOf<(ParticleType)A, (ParticleType)B> Reaction;
+    return PairInteraction{Force::value, Reaction::value, Reaction::productA, Reaction::productB};
+}
+
+template<int... I>
+constexpr PairTable makePairTable(std::integer_sequence<int, I...>) {
+    PairTable table = {{makePairInteraction<I/kNbParticleTypes, I%kNbParticleTypes>()...}, {}, {}};
+    for (int a = 0; a < kNbParticleTypes; ++a)
+        for (int b = 0; b < kNbParticleTypes; ++b) {
+            const PairInteraction& entry = table.entries[a*kNbParticleTypes+b];
+            table.forceMask[a] |= (entry.force != NoForce ? 1u : 0u) << b;
+            table.reactMask[a] |= (entry.reacts ? 1u : 0u) << b;
+        }
+    return table;
+}
+
+constexpr PairTable kPairTable = makePairTable(std::make_integer_sequence<int, kNbParticleTypes*kNbParticleTypes>());
+
+inline const PairInteraction& getPairInteraction(ParticleType iA, ParticleType iB) {
+    return kPairTable.entries[iA*kNbParticleTypes+iB];
+}
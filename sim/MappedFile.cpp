@@ -0,0 +1,69 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+bool MappedFile::open(const std::string& iPath) {
+    close();
+    int fd = ::open(iPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size = (size_t)status.st_size;
+    if (size > 0) {
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return false;
+        }
+        // Read front to back
+        madvise(address, size, MADV_SEQUENTIAL);
+        mapping = address;
+        data = (const char*)address;
+    }
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping)
+        munmap(mapping, size);
+    mapping = nullptr;
+    data = nullptr;
+    size = 0;
+}
+#else
+bool MappedFile::open(const std::string& iPath) {
+    close();
+    std::ifstream file(iPath, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    buffer.resize((size_t)file.tellg());
+    file.seekg(0);
+    if (!file.read(buffer.data(), buffer.size()))
+        return false;
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+    buffer.clear();
+    buffer.shrink_to_fit();
+    data = nullptr;
+    size = 0;
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Read only view of a whole file, memory mapped so that pages are loaded on
+// first access by the OS instead of copied through a stream buffer.
+// Without mmap (Windows) the file is read at once into memory.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& iPath);
+    void close();
+
+private:
+    void* mapping = nullptr;
+    std::vector<char> buffer; // fallback without mmap
+};
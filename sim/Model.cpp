@@ -0,0 +1,724 @@
+#include "Model.h"
+#include "CounterRng.h"
+#include "Profiler.h"
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::init() {
+    _step = 0;
+    // Initialize particles
+    clear();
+    for (int i = 0; i < K_INIT_PARTICLES; ++i) {
+        spawn((ParticleType)(i % 4), Vec2f(0, 0), 0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::emit(const Emitter& iEmitter, int iCount, int iSpawnStep) {
+    // Cumulated weights of the mix, the type is only drawn when there are several
+    float cumulated[kNbParticleTypes];
+    float total = 0.0f;
+    int nbTypes = 0;
+    ParticleType single = ParticleType::F;
+    for (int t = 0; t < kNbParticleTypes; ++t) {
+        if (iEmitter.mix[t] > 0.0f) {
+            total += iEmitter.mix[t];
+            single = (ParticleType)t;
+            ++nbTypes;
+        }
+        cumulated[t] = total;
+    }
+    if (iCount <= 0 || nbTypes == 0)
+        return;
+    std::uniform_real_distribution<> disX(-iEmitter.halfSize.x, iEmitter.halfSize.x);
+    std::uniform_real_distribution<> disY(-iEmitter.halfSize.y, iEmitter.halfSize.y);
+    std::uniform_real_distribution<> disR(0.0, 1.0);
+    std::uniform_real_distribution<> disV(-0.5, 0.5);
+    std::uniform_real_distribution<> disA(0, 2.0*M_PI);
+    std::uniform_real_distribution<> disMix(0.0, total);
+
+    particles.reserveMore(iCount);
+    for (int i = 0; i < iCount; ++i) {
+        Vec2f position;
+        if (iEmitter.shape == Emitter::Disc) {
+            // Square root for a uniform density over the disc
+            float radius = iEmitter.halfSize.x*std::sqrt(disR(gen));
+            float angle = disA(gen);
+            position = Vec2f(radius*std::cos(angle), radius*std::sin(angle));
+        } else {
+            position = Vec2f(disX(gen), disY(gen));
+        }
+        position += iEmitter.center;
+        Vec2f velocity = Vec2f(disV(gen), disV(gen));
+        float orientation = disA(gen);
+        ParticleType type = single;
+        if (nbTypes > 1) {
+            float u = disMix(gen);
+            int t = 0;
+            while (t < kNbParticleTypes-1 && u >= cumulated[t])
+                ++t;
+            type = (ParticleType)t;
+        }
+        particles.add(type, position, velocity, orientation, iSpawnStep);
+    }
+    verletLists.invalidate();
+}
+
+void Model::emit() {
+    int total = 0;
+    for (const Emitter& emitter : emitters)
+        total += emitter.countAt(_step);
+    if (total == 0)
+        return;
+    particles.reserveMore(total);
+    for (const Emitter& emitter : emitters)
+        emit(emitter, emitter.countAt(_step), _step);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::calculateForceAndTorque_polar1(int p,
+                                           int other,
+                                           const Vec2f& r,
+                                           float rNorm,
+                                           Vec2f& oForce,
+                                           float& oTorque,
+                                           float* oOtherTorque) {
+    float orientation1 = particles.orientation[p];
+    float orientation2 = particles.orientation[other];
+
+    // The interaction strength
+    float teta = orientation2 - orientation1;
+    // Make sure it is between -pi and pi
+    while (teta > M_PI) teta -= 2 * M_PI;
+    while (teta < -M_PI) teta += 2 * M_PI;
+    float phi = angleFromVector(r) - orientation1;
+    float anti_phi = angleFromVector(-r) - orientation2;
+    // Make sure it is between -pi and pi
+    while (phi > M_PI) phi -= 2 * M_PI;
+    while (phi < -M_PI) phi += 2 * M_PI;
+    while (anti_phi > M_PI) anti_phi -= 2 * M_PI;
+    while (anti_phi < -M_PI) anti_phi += 2 * M_PI;
+
+    float opposition = std::max(std::abs(phi), std::abs(anti_phi));
+
+    //Here I need a f such that:
+    //f(teta, phi) = f(-teta, phi-teta+pi) //action reaction symmetry)
+    //f(teta, phi) = f(-teta, -phi) //mirror symmetry
+    float anisoFactor = 1.0f;//sin(teta)*sin(phi)+sin(teta)*sin(phi-teta) + 1.6f;
+    float g_opposition_threshold_sp = 0.1;
+    if (opposition < config.opposition_threshold-g_opposition_threshold_sp) {
+        anisoFactor = -1.0f;
+    } else if (opposition < config.opposition_threshold+g_opposition_threshold_sp) {
+        anisoFactor = ((opposition - (config.opposition_threshold-g_opposition_threshold_sp))/(2*g_opposition_threshold_sp))*2.0-1.0; //supposed to be in -1.0 1.0
+    }
+    //if (((2*phi-teta+M_PI)*(2*phi-teta+M_PI)+teta*teta) < 2.0*config.div_angle*config.div_angle) anisoFactor = -1.0f;
+    //2*phi-teta is an invariant angle in an interacting pair
+    float rotatorFactor = sin(2*phi-teta+M_PI);//(sin(teta)*sin(phi)+sin(teta)*sin(phi-teta))/2.0f;// * M_PI;
+    float distanceFactor = getDistanceFactor(rNorm);
+
+    oForce = rotateVector(r, rotatorFactor) * (10.0f*rotatorFactor*rotatorFactor + 1.0f) * config.s_f_strength * anisoFactor * distanceFactor;
+
+    //Something like (phi>0)
+    float midAngle = middleAngle(orientation1, orientation2);
+    float side = dot(r, rotateVector(unitVectorFromAngle(midAngle), -M_PI/2.0));
+    bool isLeft = side > 0;
+
+    //Debug left right
+    //if(isLeft) {p.shape.setFillColor(sf::Color::Red);} else {p.shape.setFillColor(sf::Color::Blue);}
+
+    float leftTargetOffset = (-teta-config.div_angle)/2.0;
+    float righTargetOffset = (-teta+config.div_angle)/2.0;
+    while (leftTargetOffset > M_PI) leftTargetOffset -= 2 * M_PI;
+    while (leftTargetOffset < -M_PI) leftTargetOffset += 2 * M_PI;
+    while (righTargetOffset > M_PI) righTargetOffset -= 2 * M_PI;
+    while (righTargetOffset < -M_PI) righTargetOffset += 2 * M_PI;
+    float dirFactor = ((isLeft && (leftTargetOffset<0)) || (!isLeft && (righTargetOffset<0))) ? 1.0f : -1.0f;
+    oTorque = dirFactor*config.s_t_strength;
+
+    //Torque influence as well diminish with distance
+    oTorque = oTorque/(rNorm);
+
+    //Mutual viscosity system (particles try to slow to the center of mass of the system)
+    //TODO repulsion should be an exception!
+    const Vec2f& v1 = particles.velocity[p];
+    const Vec2f& v2 = particles.velocity[other];
+    float w1 = particles.angularVelocity[p];
+    float w2 = particles.angularVelocity[other];
+    oForce += ((v1+v2)/2.0f-v1)*config.s_f_viscosity;
+    oTorque += ((w1+w2)/2.0f-w1)*config.s_t_viscosity;
+
+    if (oOtherTorque) {
+        // Same rule seen from other: teta and r change sign, the mid angle is shared
+        bool isLeftOther = side < 0;
+        float leftTargetOffsetOther = (teta-config.div_angle)/2.0;
+        float righTargetOffsetOther = (teta+config.div_angle)/2.0;
+        while (leftTargetOffsetOther > M_PI) leftTargetOffsetOther -= 2 * M_PI;
+        while (leftTargetOffsetOther < -M_PI) leftTargetOffsetOther += 2 * M_PI;
+        while (righTargetOffsetOther > M_PI) righTargetOffsetOther -= 2 * M_PI;
+        while (righTargetOffsetOther < -M_PI) righTargetOffsetOther += 2 * M_PI;
+        float dirFactorOther = ((isLeftOther && (leftTargetOffsetOther<0)) || (!isLeftOther && (righTargetOffsetOther<0))) ? 1.0f : -1.0f;
+        *oOtherTorque = dirFactorOther*config.s_t_strength/rNorm + ((w1+w2)/2.0f-w2)*config.s_t_viscosity;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::updateComplexPolarConstants() {
+    const float oppositionSp = 0.1f;
+    complexPolar.cosDiv = std::cos(config.div_angle);
+    complexPolar.sinDiv = std::sin(config.div_angle);
+    complexPolar.oppositionLow = config.opposition_threshold-oppositionSp;
+    complexPolar.oppositionHigh = config.opposition_threshold+oppositionSp;
+    complexPolar.cosOppositionLow = std::cos(std::max(0.0f, std::min((float)M_PI, complexPolar.oppositionLow)));
+    complexPolar.cosOppositionHigh = std::cos(std::max(0.0f, std::min((float)M_PI, complexPolar.oppositionHigh)));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::calculateForceAndTorque_polar1_complex(int p,
+                                                   int other,
+                                                   const Vec2f& r,
+                                                   float rNorm,
+                                                   Vec2f& oForce,
+                                                   float& oTorque,
+                                                   float* oOtherTorque) {
+    const Vec2f& u1 = particles.heading[p];
+    const Vec2f& u2 = particles.heading[other];
+    Vec2f rUnit = r / rNorm;
+
+    float cosTeta = dot(u1, u2);
+    float sinTeta = cross(u1, u2);
+    float cosPhi = dot(u1, rUnit);
+    float sinPhi = cross(u1, rUnit);
+    float cosAntiPhi = -dot(u2, rUnit);
+
+    // opposition = max(|phi|, |anti_phi|) compared through its cosine
+    float cosOpposition = std::min(cosPhi, cosAntiPhi);
+    float anisoFactor = 1.0f;
+    bool belowLow = complexPolar.oppositionLow > M_PI ||
+                    (complexPolar.oppositionLow > 0.0f && cosOpposition > complexPolar.cosOppositionLow);
+    bool aboveHigh = complexPolar.oppositionHigh <= 0.0f ||
+                     (complexPolar.oppositionHigh <= M_PI && cosOpposition <= complexPolar.cosOppositionHigh);
+    if (belowLow) {
+        anisoFactor = -1.0f;
+    } else if (!aboveHigh) {
+        float opposition = std::acos(std::max(-1.0f, std::min(1.0f, cosOpposition)));
+        anisoFactor = ((opposition - complexPolar.oppositionLow)/(complexPolar.oppositionHigh-complexPolar.oppositionLow))*2.0-1.0;
+    }
+
+    // sin(2*phi-teta+pi)
+    float sin2Phi = 2.0f*sinPhi*cosPhi;
+    float cos2Phi = cosPhi*cosPhi - sinPhi*sinPhi;
+    float rotatorFactor = -(sin2Phi*cosTeta - cos2Phi*sinTeta);
+    float distanceFactor = getDistanceFactor(rNorm);
+    float sinRotator, cosRotator;
+    smallAngleSinCos(rotatorFactor, sinRotator, cosRotator);
+    Vec2f rotated(r.x*cosRotator - r.y*sinRotator, r.x*sinRotator + r.y*cosRotator);
+    oForce = rotated * (10.0f*rotatorFactor*rotatorFactor + 1.0f) * config.s_f_strength * anisoFactor * distanceFactor;
+
+    // Left or right of the mid angle, u1+u2 points along it
+    Vec2f mid = u1 + u2;
+    float side = (mid.x*mid.x + mid.y*mid.y > 1e-12f) ? cross(r, mid) : dot(r, u1);
+    bool isLeft = side > 0;
+    // teta > config.div_angle and teta > -config.div_angle, teta in [-pi, pi]
+    const float cosDiv = complexPolar.cosDiv;
+    const float sinDiv = complexPolar.sinDiv;
+    bool tetaAboveDiv = (sinTeta*cosDiv - cosTeta*sinDiv > 0) && !(sinTeta < 0 && cosTeta < -cosDiv);
+    bool tetaAboveMinusDiv = (sinTeta*cosDiv + cosTeta*sinDiv > 0) || (sinTeta >= 0 && cosTeta < -cosDiv);
+    float dirFactor = (isLeft ? tetaAboveMinusDiv : tetaAboveDiv) ? 1.0f : -1.0f;
+    oTorque = dirFactor*config.s_t_strength/rNorm;
+
+    //Mutual viscosity system
+    const Vec2f& v1 = particles.velocity[p];
+    const Vec2f& v2 = particles.velocity[other];
+    float w1 = particles.angularVelocity[p];
+    float w2 = particles.angularVelocity[other];
+    oForce += ((v1+v2)/2.0f-v1)*config.s_f_viscosity;
+    oTorque += ((w1+w2)/2.0f-w1)*config.s_t_viscosity;
+
+    if (oOtherTorque) {
+        bool isLeftOther = side < 0;
+        float dirFactorOther = (isLeftOther ? !tetaAboveDiv : !tetaAboveMinusDiv) ? 1.0f : -1.0f;
+        *oOtherTorque = dirFactorOther*config.s_t_strength/rNorm + ((w1+w2)/2.0f-w2)*config.s_t_viscosity;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::calculateForceAndTorque_polar(int p,
+                                          int other,
+                                          const Vec2f& r,
+                                          float rNorm,
+                                          Vec2f& oForce,
+                                          float& oTorque,
+                                          float* oOtherTorque) {
+    if (config.complex_orientation)
+        calculateForceAndTorque_polar1_complex(p, other, r, rNorm, oForce, oTorque, oOtherTorque);
+    else
+        calculateForceAndTorque_polar1(p, other, r, rNorm, oForce, oTorque, oOtherTorque);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::calculateForce_quadraticAttraction(float forceMagnitude, const Vec2f& r, float rNorm, Vec2f& force) {
+    force = r * (forceMagnitude / (rNorm*rNorm));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::react() {
+    const std::vector<Vec2f>& position = particles.position;
+    const std::vector<ParticleType>& type = particles.type;
+    float reactionRadius2 = config.reactionRadius()*config.reactionRadius();
+
+    tileReactions.resize(plug.tileCount());
+    pool.parallelFor(plug.tileCount(), [&](int t) {
+        std::vector<ReactionCandidate>& candidates = tileReactions[t];
+        candidates.clear();
+        // Pair a < b
+        auto addCandidate = [&](int a, int b) {
+            if (!getPairInteraction(type[a], type[b]).reacts)
+                return;
+            Vec2f r = position[b] - position[a];
+            float rNorm2 = r.x*r.x + r.y*r.y;
+            if (rNorm2 < reactionRadius2)
+                candidates.push_back(ReactionCandidate{rNorm2, a, b});
+        };
+        for (int p : plug.getTile(t)) {
+            if (!canReact(type[p]))
+                continue;
+            if (config.verlet_lists) {
+                // Each pair is in one list only
+                verletLists.forEachNeighbour(p, [&](int other) {
+                    addCandidate(std::min(p, other), std::max(p, other));
+                });
+            } else {
+                // Only the types p reacts with
+                plug.forEachNeighbourOfTypes(position[p], kPairTable.reactMask[type[p]],
+                                             [&](int other, ParticleType) {
+                    // Each pair is seen from both sides, keep one
+                    if (other > p)
+                        addCandidate(p, other);
+                });
+            }
+        }
+    });
+
+    reactions.clear();
+    for (const std::vector<ReactionCandidate>& candidates : tileReactions)
+        reactions.insert(reactions.end(), candidates.begin(), candidates.end());
+    if (reactions.empty())
+        return;
+    std::sort(reactions.begin(), reactions.end(), [](const ReactionCandidate& c1, const ReactionCandidate& c2) {
+        if (c1.distance2 != c2.distance2) return c1.distance2 < c2.distance2;
+        if (c1.a != c2.a) return c1.a < c2.a;
+        return c1.b < c2.b;
+    });
+
+    reacted.assign(particles.size(), 0);
+    int nbReactions = 0;
+    for (const ReactionCandidate& c : reactions) {
+        if (reacted[c.a] || reacted[c.b])
+            continue;
+        ++nbReactions;
+        reacted[c.a] = 1;
+        reacted[c.b] = 1;
+        ParticleType typeA = particles.type[c.a];
+        ParticleType typeB = particles.type[c.b];
+        ++reactionCounts[std::min(typeA, typeB)*kNbParticleTypes + std::max(typeA, typeB)];
+        ParticleType productA, productB;
+        getReaction(typeA, typeB, productA, productB);
+        particles.type[c.a] = productA;
+        particles.type[c.b] = productB;
+        particles.spawnStep[c.a] = _step;
+        particles.spawnStep[c.b] = _step;
+    }
+    g_profiler.count(Profiler::Reactions, nbReactions);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static void countPairs(const PairCounts& iCounts) {
+    g_profiler.count(Profiler::PairsVisited, iCounts.visited);
+    g_profiler.count(Profiler::PairsInRadius, iCounts.inRadius);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::computeForces(int p, PairCounts& ioCounts) {
+    particles.force[p] = Vec2f(0.0, 0.0);
+    particles.torque[p] = 0.0;
+    ParticleType pType = particles.type[p];
+    const bool batched = pType == ParticleType::S && useSimdKernel();
+    PolarBatch batch;
+    if (batched)
+        initPolarBatch(p, batch);
+
+    //General forces with the types p interacts with
+    plug.forEachNeighbourOfTypes(particles.position[p], kPairTable.forceMask[pType],
+                                 [&](int other, ParticleType otherType) {
+        if (other != p)  // Avoid self-interaction
+            ioCounts.inRadius += dispatchPairForces<false>(p, other, otherType, batched ? &batch : nullptr,
+                                                           ioCounts.visited);
+    });
+
+    if (batched && batch.size > 0)
+        flushPolarBatch(p, batch, false);
+
+    computeExternalForces(p);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::flushPolarBatch(int p, PolarBatch& ioBatch, bool iScatter) {
+#ifdef PARTICLELIFE_AVX2
+    calculateForceAndTorque_polar1_avx2(ioBatch, config);
+#endif
+    std::vector<Vec2f>& force = particles.force;
+    std::vector<float>& torque = particles.torque;
+    for (int k = 0; k < ioBatch.size; ++k) {
+        Vec2f pairForce(ioBatch.fx[k], ioBatch.fy[k]);
+        force[p] += pairForce;
+        torque[p] += ioBatch.torque[k];
+        if (iScatter) {
+            force[ioBatch.other[k]] -= pairForce;
+            torque[ioBatch.other[k]] += ioBatch.otherTorque[k];
+        }
+    }
+    ioBatch.size = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::computeExternalForces(int p) {
+    const std::vector<Vec2f>& position = particles.position;
+    const std::vector<Vec2f>& velocity = particles.velocity;
+    const std::vector<ParticleType>& type = particles.type;
+    Vec2f& pForce = particles.force[p];
+
+    if (!config.destroy_at_boundary) {
+        // Containing forces //could be constrained by direction of v as well
+        if (position[p].x > config.world_width/2) pForce += Vec2f(-config.containing_force,0.0);
+        if (position[p].x < -config.world_width/2) pForce += Vec2f(config.containing_force,0.0);
+        if (position[p].y > config.world_height/2) pForce += Vec2f(0.0,-config.containing_force);
+        if (position[p].y < -config.world_height/2) pForce += Vec2f(0.0,config.containing_force);
+    }
+
+    // Brownian motion model
+    // Particle are boosted in the direction of their velocity below a given value.
+    // + a rotation perturbation
+    // The random part is drawn afterwards, see step()
+    if (type[p] == ParticleType::S) {
+        if (norm(velocity[p]) <= config.temp_speed)
+        {
+            pForce += 0.01f*velocity[p] / config.dt;
+        }
+    } else {
+        if (norm(velocity[p]) <= 1.0)
+        {
+            pForce += 0.01f*velocity[p] / config.dt;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+template<PairForce Kind, bool Both>
+bool Model::addPairForces(int p, int other, PolarBatch* ioBatch) {
+    const std::vector<Vec2f>& position = particles.position;
+    std::vector<Vec2f>& force = particles.force;
+    std::vector<float>& torque = particles.torque;
+    Vec2f r = position[other] - position[p];
+    float rNorm = norm(r);
+    if (rNorm >= config.interaction_radius)
+        return false;
+    if (Kind == PolarForce) {
+        // Surfactant molecules S interaction model
+        if (ioBatch) {
+            ioBatch->push(other, r, rNorm, particles.orientation[other],
+                          particles.velocity[other], particles.angularVelocity[other]);
+            if (ioBatch->full())
+                flushPolarBatch(p, *ioBatch, Both);
+            return true;
+        }
+        Vec2f pairForce(0.0, 0.0);
+        float pairTorque = 0.0;
+        float otherTorque = 0.0;
+        //Force model for vesicle formation
+        calculateForceAndTorque_polar(p, other,
+                                      r, rNorm,
+                                      pairForce, pairTorque, Both ? &otherTorque : nullptr);
+
+        //Solid repulsion
+        if (rNorm < 2.0*2.0*DOT_SIZE) //The first 2 is for progressive smoothing
+        {
+            float factor = getRepulsion9(rNorm);
+            pairForce += -r * factor;
+        }
+        force[p] += pairForce;
+        torque[p] += pairTorque;
+        if (Both) {
+            // Action reaction
+            force[other] -= pairForce;
+            torque[other] += otherTorque;
+        }
+    } else {
+        // Surfactant molecules S walling model, the factor is shared and
+        // each side gets its own strength. Negative for repulsion
+        float factor = getRepulsion6(rNorm);
+        float pStrength = Kind == WallForce ? 0.001f : 10.0f;
+        float otherStrength = Kind == WallForce ? 10.0f : 0.001f;
+        force[p] += -r * factor * pStrength;
+        if (Both)
+            force[other] += r * factor * otherStrength;
+    }
+    return true;
+}
+
+template<bool Both>
+bool Model::dispatchPairForces(int p, int other, ParticleType iOtherType, PolarBatch* ioBatch,
+                               long long& ioVisited) {
+    switch (getPairInteraction(particles.type[p], iOtherType).force) {
+    case PolarForce: ++ioVisited; return addPairForces<PolarForce, Both>(p, other, ioBatch);
+    case WallForce: ++ioVisited; return addPairForces<WallForce, Both>(p, other, nullptr);
+    case WalledForce: ++ioVisited; return addPairForces<WalledForce, Both>(p, other, nullptr);
+    case NoForce: break;
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+template<typename ForEachOther>
+void Model::computeHalfPairForces(int p, PairCounts& ioCounts, ForEachOther iForEachOther) {
+    if (!kPairTable.forceMask[particles.type[p]])
+        return;
+    // S-S pairs go through the batched kernel
+    const bool batched = particles.type[p] == ParticleType::S && useSimdKernel();
+    PolarBatch batch;
+    if (batched)
+        initPolarBatch(p, batch);
+    iForEachOther([&](int other, ParticleType otherType) {
+        ioCounts.inRadius += dispatchPairForces<true>(p, other, otherType, batched ? &batch : nullptr,
+                                                      ioCounts.visited);
+    });
+    if (batched && batch.size > 0)
+        flushPolarBatch(p, batch, true);
+}
+
+void Model::computeHalfStencilForces(int p, int iSlot, int i, int j, PairCounts& ioCounts) {
+    unsigned mask = kPairTable.forceMask[particles.type[p]];
+    computeHalfPairForces(p, ioCounts, [&](auto f) {
+        plug.forEachHalfNeighbourOfTypes(iSlot, i, j, mask, f);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::computeForcesHalfStencil() {
+    pool.parallelFor(plug.tileCount(), [this](int t) {
+        for (int p : plug.getTile(t)) {
+            particles.force[p] = Vec2f(0.0, 0.0);
+            particles.torque[p] = 0.0;
+        }
+    });
+    if (config.verlet_lists) {
+        const Plug& cells = verletLists.cells;
+        for (int colour = 0; colour < 4; ++colour) {
+            pool.parallelFor(cells.halfTileCount(colour), [this, &cells, colour](int t) {
+                PairCounts counts;
+                cells.forEachInHalfTile(colour, t, [this, &counts](int p, int, int, int) {
+                    // The lists hold every type, reactions change them between builds
+                    computeHalfPairForces(p, counts, [&](auto f) {
+                        verletLists.forEachNeighbour(p, [&](int other) {
+                            f(other, particles.type[other]);
+                        });
+                    });
+                });
+                countPairs(counts);
+            });
+        }
+    } else {
+        for (int colour = 0; colour < 4; ++colour) {
+            pool.parallelFor(plug.halfTileCount(colour), [this, colour](int t) {
+                PairCounts counts;
+                plug.forEachInHalfTile(colour, t, [this, &counts](int p, int slot, int i, int j) {
+                    computeHalfStencilForces(p, slot, i, j, counts);
+                });
+                countPairs(counts);
+            });
+        }
+    }
+    pool.parallelFor(plug.tileCount(), [this](int t) {
+        for (int p : plug.getTile(t))
+            computeExternalForces(p);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::integrate(int p) {
+    std::vector<Vec2f>& position = particles.position;
+    std::vector<Vec2f>& velocity = particles.velocity;
+    // Calculate the acceleration and angular acceleration (assuming mass and moment of inertia = 1)
+    Vec2f acceleration = particles.force[p];
+    float angularAcceleration = particles.torque[p];
+    float& angularVelocity = particles.angularVelocity[p];
+
+    // Using naive algo
+    velocity[p] = velocity[p] + acceleration * config.dt;
+    angularVelocity = angularVelocity + angularAcceleration * config.dt;
+
+    // Cap velocity
+    float maxVelocity = 2.0;
+    if (norm(velocity[p]) > maxVelocity) {
+        normalize(velocity[p]);
+        velocity[p] *= maxVelocity;
+    }
+
+    // Cap angular velocity
+    float maxAngularVelocity = 10.0;
+    if (angularVelocity > maxAngularVelocity) angularVelocity = maxAngularVelocity;
+    if (angularVelocity < -maxAngularVelocity) angularVelocity = -maxAngularVelocity;
+
+    //Force attract to center to incentive interactions
+    if (config.centerize) {
+        velocity[p] -= config.center_force * position[p];
+    }
+
+    //Sticky dissipative space and other limits
+    velocity[p] = config.void_viscosity * velocity[p];
+    angularVelocity *= config.void_torque_viscosity;
+
+    // Update
+    position[p] = position[p] + velocity[p] * config.dt;
+    particles.orientation[p] = particles.orientation[p] + angularVelocity * config.dt;
+    if (config.complex_orientation) {
+        // Rotate the heading by angularVelocity*dt and renormalise
+        float angle = angularVelocity * config.dt;
+        float sn, cs;
+        if (std::abs(angle) <= 1.0f) {
+            smallAngleSinCos(angle, sn, cs);
+        } else {
+            sn = std::sin(angle);
+            cs = std::cos(angle);
+        }
+        Vec2f& heading = particles.heading[p];
+        heading = Vec2f(heading.x*cs - heading.y*sn, heading.x*sn + heading.y*cs);
+        normalize(heading);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::step() {
+    {
+        // Before the step counter moves, spawn steps are those of the previous step
+        ProfileScope scope(Profiler::Emit);
+        emit();
+    }
+    ++_step;
+    std::vector<Vec2f>& position = particles.position;
+
+    if (config.destroy_at_boundary) {
+        ProfileScope scope(Profiler::Compaction);
+        // Containing delete
+        for (int p = 0; p < particles.size();) {
+            if ((position[p].x > config.world_width/2) || (position[p].x < -config.world_width/2) || (position[p].y > config.world_height/2) || (position[p].y < -config.world_height/2)) {
+                // The last particle is moved to index p and checked next
+                erase(p);
+            } else {
+                ++p;
+            }
+        }
+    }
+
+    {
+        ProfileScope scope(Profiler::Rebuild);
+        // nb_threads comes unchecked from scenarios and the command line
+        int nbThreads = std::max(1, config.nb_threads);
+        if (pool.threadCount() != nbThreads)
+            pool.setThreadCount(nbThreads);
+
+        // Headings are only integrated in complex mode, resync them when it is switched on
+        if (config.complex_orientation) {
+            if (!headingInSync) {
+                for (int p = 0; p < particles.size(); ++p)
+                    particles.heading[p] = unitVectorFromAngle(particles.orientation[p]);
+            }
+            updateComplexPolarConstants();
+        }
+        headingInSync = config.complex_orientation;
+        if (config.radial_tables)
+            radialKernels.update(config.interaction_radius, config.s_f_exp_power);
+
+        // Cell membership of every particle, once per step
+        plug.updateGrid(particles.size(), config);
+        plug.rebuild(position, particles.type, pool);
+        if (config.verlet_lists && verletLists.update(plug, position, config.interaction_radius, config.verlet_skin, pool))
+            g_profiler.count(Profiler::NeighbourBuilds, 1);
+    }
+
+    if (config.cluster_interval > 0 && _step % config.cluster_interval == 0) {
+        ProfileScope scope(Profiler::Clusters);
+        clusters.update(particles, plug, config, _step);
+    }
+
+    {
+        ProfileScope scope(Profiler::React);
+        react();
+    }
+
+    {
+        ProfileScope scope(Profiler::Forces);
+        if (config.half_stencil || config.verlet_lists) {
+            computeForcesHalfStencil();
+        } else {
+            pool.parallelFor(plug.tileCount(), [this](int t) {
+                PairCounts counts;
+                for (int p : plug.getTile(t))
+                    computeForces(p, counts);
+                countPairs(counts);
+            });
+        }
+    }
+
+    {
+        ProfileScope scope(Profiler::Brownian);
+        // Brownian perturbation, counted by (particle, step) so that no
+        // generator is shared and tiles draw in any order
+        uint32_t seed = (uint32_t)config.seed;
+        uint32_t step = (uint32_t)_step;
+        pool.parallelFor(plug.tileCount(), [this, seed, step](int t) {
+            for (int p : plug.getTile(t)) {
+                if (particles.type[p] == ParticleType::S)
+                    continue;
+                Philox4x32 kick(seed, BrownianStream, (uint32_t)p, step);
+                particles.force[p] += Vec2f(kick.uniform(0, -0.01f, 0.01f), kick.uniform(1, -0.01f, 0.01f));
+            }
+        });
+    }
+
+    {
+        ProfileScope scope(Profiler::Integrate);
+        // Update particles from forces
+        pool.parallelFor(plug.tileCount(), [this](int t) {
+            for (int p : plug.getTile(t))
+                integrate(p);
+        });
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+long long Model::countInteractingPairs() {
+    const std::vector<Vec2f>& position = particles.position;
+    float radius2 = config.interaction_radius*config.interaction_radius;
+    plug.rebuild(position, particles.type, pool);
+    std::vector<long long> tileCounts(plug.tileCount(), 0);
+    pool.parallelFor(plug.tileCount(), [&](int t) {
+        for (int p : plug.getTile(t)) {
+            plug.forEachNeighbourOfTypes(position[p], kPairTable.forceMask[particles.type[p]],
+                                         [&](int other, ParticleType) {
+                Vec2f r = position[other] - position[p];
+                if (other > p && r.x*r.x + r.y*r.y < radius2)
+                    ++tileCounts[t];
+            });
+        }
+    });
+    long long count = 0;
+    for (long long tileCount : tileCounts)
+        count += tileCount;
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Model::analyseClusters() {
+    plug.rebuild(particles.position, particles.type, pool);
+    clusters.update(particles, plug, config, _step);
+}
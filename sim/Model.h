@@ -0,0 +1,257 @@
+#pragma once
+#include "Clusters.h"
+#include "Emitter.h"
+#include "Interactions.h"
+#include "Params.h"
+#include "ParticleStore.h"
+#include "Plug.h"
+#include "PolarKernel.h"
+#include "RadialKernels.h"
+#include "ThreadPool.h"
+#include "Vec2.h"
+#include "VerletLists.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <random>
+#include <vector>
+
+
+// Constants of the complex S-S kernel that only depend on sliders
+struct ComplexPolarConstants {
+    float cosDiv;
+    float sinDiv;
+    float oppositionLow;
+    float oppositionHigh;
+    float cosOppositionLow;
+    float cosOppositionHigh;
+};
+
+// Pair of particles a < b close enough to react
+struct ReactionCandidate {
+    float distance2;
+    int a;
+    int b;
+};
+
+// Pair counters of one force task, given to the profiler when the task ends
+// rather than per particle: its counters are shared by every thread
+struct PairCounts {
+    long long visited = 0;
+    long long inRadius = 0;
+};
+
+struct Model {
+    ModelConfig config; // Read by step(), change it between steps only
+    ParticleStore particles;
+    std::mt19937 gen; // Emission draws, reseeded from config.seed by clear()
+    int _step;
+    Plug plug;
+    VerletLists verletLists;
+    ThreadPool pool;
+    ComplexPolarConstants complexPolar;
+    RadialKernels radialKernels;
+    bool headingInSync = true;
+    std::vector<std::vector<ReactionCandidate>> tileReactions;
+    std::vector<ReactionCandidate> reactions;
+    std::vector<char> reacted;
+    std::vector<Emitter> emitters; // run at the start of every step
+    ClusterTracker clusters; // S clusters, every config.cluster_interval steps
+    // Reactions committed since the last clear(), per pair of reactant types
+    // [min*kNbParticleTypes+max]
+    long long reactionCounts[kNbParticleTypes*kNbParticleTypes] = {};
+
+    explicit Model(const ModelConfig& iConfig = ModelConfig()) : config(iConfig), gen(config.seed){
+        init();
+    }
+
+    void init();
+
+    // One particle of iParticleType in the tenth of the world around iOrigin
+    void spawn(const ParticleType& iParticleType, Vec2f iOrigin, int iSpawnStep) {
+        Vec2f halfSize(config.world_width/20.0f, config.world_height/20.0f);
+        emit(Emitter::ofType(iParticleType, iOrigin, halfSize), 1, iSpawnStep);
+    }
+    // iCount particles of iEmitter in one batch: a single reservation, the
+    // distributions are built once. The plug picks them up at the next rebuild.
+    void emit(const Emitter& iEmitter, int iCount, int iSpawnStep);
+    // What every emitter gives at the current step, in one batch
+    void emit();
+
+    // Swap and pop compaction, the last particle takes index i
+    // The plug is invalid until the next rebuild
+    void erase(int i) {
+        particles.swapAndPop(i);
+        verletLists.invalidate();
+    }
+
+    void clear() {
+        particles.clear();
+        plug.configure(config);
+        plug.clear();
+        verletLists.invalidate();
+        gen.seed(config.seed);
+        clusters.reset();
+        std::fill(std::begin(reactionCounts), std::end(reactionCounts), 0);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////
+    // The force on other is exactly -oForce, when oOtherTorque is given the
+    // torque on other is computed as well (half stencil)
+    void calculateForceAndTorque_polar1(int p,
+                                        int other,
+                                        const Vec2f& r,
+                                        float rNorm,
+                                        Vec2f& oForce,
+                                        float& oTorque,
+                                        float* oOtherTorque = nullptr);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Radial factors, from the tables or computed
+    float getDistanceFactor(float rNorm) const {
+        return config.radial_tables ? radialKernels.lookup(rNorm).distanceFactor : 1.0f / std::pow(rNorm, config.s_f_exp_power);
+    }
+    float getRepulsion9(float rNorm) const {
+        return config.radial_tables ? radialKernels.lookup(rNorm).repulsion9 : std::pow(2.0*DOT_SIZE/rNorm, 9);
+    }
+    float getRepulsion6(float rNorm) const {
+        return config.radial_tables ? radialKernels.lookup(rNorm).repulsion6 : std::pow(2.0*DOT_SIZE/rNorm, 6);
+    }
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Slider dependent constants of the complex kernel, refreshed every step
+    void updateComplexPolarConstants();
+
+    //////////////////////////////////////////////////////////////////////////////
+    // calculateForceAndTorque_polar1 with orientations stored as unit vectors
+    // u = (cos, sin). Angles become dot and cross products:
+    // cos/sin teta = u1.u2 / u1xu2, cos/sin phi = u1.r^ / u1xr^,
+    // sin(2phi-teta+pi) by angle sum formulas, the mid angle direction is u1+u2.
+    // Trig is left only for the rotation by the rotator factor (a polynomial,
+    // |angle| <= 1) and for the pairs on the 0.2 rad opposition ramp (acos).
+    void calculateForceAndTorque_polar1_complex(int p,
+                                                int other,
+                                                const Vec2f& r,
+                                                float rNorm,
+                                                Vec2f& oForce,
+                                                float& oTorque,
+                                                float* oOtherTorque = nullptr);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Scalar S-S kernel of the current orientation representation
+    void calculateForceAndTorque_polar(int p,
+                                       int other,
+                                       const Vec2f& r,
+                                       float rNorm,
+                                       Vec2f& oForce,
+                                       float& oTorque,
+                                       float* oOtherTorque = nullptr);
+
+    //////////////////////////////////////////////////////////////////////////////
+    //void calculateForce_linearAttraction(float forceMagnitude, const Vec2f& r, float rNorm, Vec2f& force) {
+    //    force = r * (forceMagnitude / rNorm);
+    //}
+
+    //////////////////////////////////////////////////////////////////////////////
+    void calculateForce_quadraticAttraction(float forceMagnitude, const Vec2f& r, float rNorm, Vec2f& force);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Products of the reaction between types iA and iB, false if they do not react
+    static bool getReaction(ParticleType iA, ParticleType iB, ParticleType& oA, ParticleType& oB) {
+        const PairInteraction& interaction = getPairInteraction(iA, iB);
+        oA = interaction.productA;
+        oB = interaction.productB;
+        return interaction.reacts;
+    }
+    static bool canReact(ParticleType iType) {
+        return kPairTable.reactMask[iType] != 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Chemical reactions, in two phases before the force phase:
+    // - every tile collects the reacting pairs within config.reactionRadius(), reading
+    //   the types only, the cells are only searched for the types that react
+    // - candidates are sorted by distance then indices and every particle takes
+    //   part in at most one reaction, the closest one, then all are committed
+    // The outcome does not depend on the iteration order or the thread count.
+    void react();
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Calculate the force and torque on particle p due to all other particles
+    // Only force[p] and torque[p] are written, the rest of the state is a read
+    // only snapshot during the force phase so particles can be processed in any
+    // order and on any thread. The pairs are counted in ioCounts.
+    void computeForces(int p, PairCounts& ioCounts);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Batched S-S kernel, AVX2 with a runtime check, the scalar path otherwise
+    bool useSimdKernel() const {
+        return config.simd_kernel && hasAvx2() && !config.complex_orientation;
+    }
+    void initPolarBatch(int p, PolarBatch& oBatch) const {
+        oBatch.size = 0;
+        oBatch.orientation1 = particles.orientation[p];
+        oBatch.v1x = particles.velocity[p].x;
+        oBatch.v1y = particles.velocity[p].y;
+        oBatch.w1 = particles.angularVelocity[p];
+    }
+    // Adds the lanes to p, and their opposite to the neighbours when iScatter (half stencil)
+    void flushPolarBatch(int p, PolarBatch& ioBatch, bool iScatter);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Forces on particle p that do not come from other particles
+    void computeExternalForces(int p);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Kernels of the interaction table for the pair (p, other), whose types have
+    // the force Kind. With Both (half stencil) the pair is evaluated once and
+    // both particles receive their share, callers make sure no other thread
+    // writes p or other at the same time (tile colouring). Otherwise only p is
+    // written. S-S pairs go to ioBatch when there is one.
+    // False when the pair is out of the interaction radius.
+    template<PairForce Kind, bool Both>
+    bool addPairForces(int p, int other, PolarBatch* ioBatch);
+    // Through the table: the kernel of the types of p and other, no distance
+    // is computed when they have no force
+    template<bool Both>
+    bool dispatchPairForces(int p, int other, ParticleType iOtherType, PolarBatch* ioBatch, long long& ioVisited);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // All the pairs (p, other) given by iForEachOther(f), that calls f(other, type of other)
+    template<typename ForEachOther>
+    void computeHalfPairForces(int p, PairCounts& ioCounts, ForEachOther iForEachOther);
+    // All the half stencil pairs of p, stored at iSlot in cell (i,j)
+    void computeHalfStencilForces(int p, int iSlot, int i, int j, PairCounts& ioCounts);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Force phase with the half stencil, tiles of the same colour are processed
+    // in parallel and the colours one after the other.
+    // With the Verlet lists the tiles are the ones of the cells the lists were
+    // built from, the lists follow the same half stencil.
+    void computeForcesHalfStencil();
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Update particle p from its force, only touches the state of p
+    void integrate(int p);
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Phases: reactions, forces from a read only snapshot, integration.
+    // Every config.cluster_interval steps the S clusters are analysed from the
+    // freshly rebuilt plug, before the reactions.
+    // Forces and integration are split over the grid tiles on the worker pool,
+    // the cell membership is rebuilt at the start of the next step.
+    // With config.verlet_lists the pairs come from the lists and are evaluated once
+    // (half stencil) whatever config.half_stencil.
+    void step();
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Pairs closer than config.interaction_radius whose types have a force, each
+    // counted once: the pair evaluations of a step with the current positions.
+    // Rebuilds the plug.
+    long long countInteractingPairs();
+
+    //////////////////////////////////////////////////////////////////////////////
+    // S cluster analysis of the current positions, out of the step schedule.
+    // Rebuilds the plug.
+    void analyseClusters();
+};
\ No newline at end of file
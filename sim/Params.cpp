@@ -0,0 +1,121 @@
+#include "Params.h"
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+int K_INIT_PARTICLES = 0;
+int DOT_SIZE = 2;
+int K_NB_TYPE = 16;
+
+int defaultThreadCount() {
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+ParamValue Param::get(const ModelConfig& iConfig) const {
+    const void* value = in(iConfig);
+    ParamValue v;
+    switch (kind) {
+    case Int: v.i = *(const int*)value; break;
+    case Float: v.f = *(const float*)value; break;
+    case Bool: v.b = *(const bool*)value; break;
+    }
+    return v;
+}
+
+void Param::set(ModelConfig& ioConfig, const ParamValue& iValue) const {
+    void* value = in(ioConfig);
+    switch (kind) {
+    case Int: *(int*)value = iValue.i; break;
+    case Float: *(float*)value = iValue.f; break;
+    case Bool: *(bool*)value = iValue.b; break;
+    }
+}
+
+std::string Param::toString(const ModelConfig& iConfig) const {
+    ParamValue v = get(iConfig);
+    switch (kind) {
+    case Int:
+        return std::to_string(v.i);
+    case Float:
+        return std::to_string(v.f);
+    case Bool:
+        return v.b ? "1" : "0";
+    }
+    return "";
+}
+
+bool Param::parse(const std::string& iValue, void* oValue) const {
+    char* end = nullptr;
+    switch (kind) {
+    case Int: {
+        long v = std::strtol(iValue.c_str(), &end, 10);
+        if (end == iValue.c_str() || *end != '\0')
+            return false;
+        *(int*)oValue = (int)v;
+        return true;
+    }
+    case Float: {
+        float v = std::strtof(iValue.c_str(), &end);
+        if (end == iValue.c_str() || *end != '\0')
+            return false;
+        *(float*)oValue = v;
+        return true;
+    }
+    case Bool:
+        if (iValue == "1" || iValue == "true" || iValue == "on") {
+            *(bool*)oValue = true;
+            return true;
+        }
+        if (iValue == "0" || iValue == "false" || iValue == "off") {
+            *(bool*)oValue = false;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+std::vector<Param>& getParams() {
+    static std::vector<Param> sParams = {
+        {"centerize", Param::Bool, offsetof(ModelConfig, centerize)},
+        {"destroy_at_boundary", Param::Bool, offsetof(ModelConfig, destroy_at_boundary)},
+        {"interaction_radius", Param::Float, offsetof(ModelConfig, interaction_radius)},
+        {"temp_speed", Param::Float, offsetof(ModelConfig, temp_speed)},
+        {"dt", Param::Float, offsetof(ModelConfig, dt)},
+        {"void_viscosity", Param::Float, offsetof(ModelConfig, void_viscosity)},
+        {"void_torque_viscosity", Param::Float, offsetof(ModelConfig, void_torque_viscosity)},
+        {"containing_force", Param::Float, offsetof(ModelConfig, containing_force)},
+        {"div_angle", Param::Float, offsetof(ModelConfig, div_angle)},
+        {"s_f_strength", Param::Float, offsetof(ModelConfig, s_f_strength)},
+        {"s_t_strength", Param::Float, offsetof(ModelConfig, s_t_strength)},
+        {"s_f_exp_power", Param::Float, offsetof(ModelConfig, s_f_exp_power)},
+        {"s_f_viscosity", Param::Float, offsetof(ModelConfig, s_f_viscosity)},
+        {"s_t_viscosity", Param::Float, offsetof(ModelConfig, s_t_viscosity)},
+        {"opposition_threshold", Param::Float, offsetof(ModelConfig, opposition_threshold)},
+        {"center_force", Param::Float, offsetof(ModelConfig, center_force)},
+        {"nb_threads", Param::Int, offsetof(ModelConfig, nb_threads)},
+        {"half_stencil", Param::Bool, offsetof(ModelConfig, half_stencil)},
+        {"simd_kernel", Param::Bool, offsetof(ModelConfig, simd_kernel)},
+        {"complex_orientation", Param::Bool, offsetof(ModelConfig, complex_orientation)},
+        {"radial_tables", Param::Bool, offsetof(ModelConfig, radial_tables)},
+        {"verlet_lists", Param::Bool, offsetof(ModelConfig, verlet_lists)},
+        {"verlet_skin", Param::Float, offsetof(ModelConfig, verlet_skin)},
+        {"sparse_grid", Param::Bool, offsetof(ModelConfig, sparse_grid)},
+        {"auto_grid", Param::Bool, offsetof(ModelConfig, auto_grid)},
+        {"seed", Param::Int, offsetof(ModelConfig, seed)},
+        {"world_width", Param::Int, offsetof(ModelConfig, world_width)},
+        {"world_height", Param::Int, offsetof(ModelConfig, world_height)},
+        {"cluster_interval", Param::Int, offsetof(ModelConfig, cluster_interval)},
+        {"cluster_contact", Param::Float, offsetof(ModelConfig, cluster_contact)},
+        {"cluster_min_size", Param::Int, offsetof(ModelConfig, cluster_min_size)},
+    };
+    return sParams;
+}
+
+Param* findParam(const std::string& iName) {
+    for (Param& param : getParams())
+        if (iName == param.name)
+            return &param;
+    return nullptr;
+}
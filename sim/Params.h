@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Tunable parameters of the simulation, shared by the GUI and the headless runner
+
+extern int K_INIT_PARTICLES;
+extern int DOT_SIZE;
+extern int K_NB_TYPE;
+
+int defaultThreadCount();
+
+//////////////////////////////////////////////////////////////////////////////
+// Parameters of one simulation, every Model has its own so that several run
+// side by side. The fields are named after their param, see getParams().
+struct ModelConfig {
+    bool centerize = false;
+    bool destroy_at_boundary = false;
+    float interaction_radius = 13.0f;//10.0f;
+    float temp_speed = 0.2f;
+    float dt = 0.1f;
+    float void_viscosity = 0.998;
+    float void_torque_viscosity = 0.977;
+    float containing_force = 1.0;
+    float div_angle = 0.377;
+    float s_f_strength = 3.21f;
+    float s_t_strength = 0.51f;
+    float s_f_exp_power = 3.18f;
+    float s_f_viscosity = 1.058f;
+    float s_t_viscosity = 1.461;
+    float opposition_threshold = 1.426;
+    float center_force = 0.0001f;
+    int nb_threads = defaultThreadCount();
+    bool half_stencil = true;
+    bool simd_kernel = true; // Only effective when the CPU has AVX2
+    bool complex_orientation = false; // Orientations as unit vectors, trig free S-S kernel
+    bool radial_tables = true; // Distance factors from RadialKernels lookup tables
+    bool verlet_lists = false; // Pairs from VerletLists instead of the grid cells
+    float verlet_skin = 2.0f;
+    bool sparse_grid = false; // Plug keeps only the occupied cells, the world is unbounded
+    bool auto_grid = true; // Plug picks its resolution, see Plug::updateGrid()
+    int seed = 5489; // Key of the random draws, a run is reproduced from its seed and scenario
+    int world_width = 480;//960;//1920;
+    int world_height = 270;//540;//1080;
+    int cluster_interval = 0; // Steps between two analyses of the S clusters, 0 for none, see ClusterTracker
+    float cluster_contact = 8.0f; // S particles closer than this are linked
+    int cluster_min_size = 3; // Smaller groups are not clusters
+
+    // Reactions happen at half the interaction radius
+    float reactionRadius() const {
+        return interaction_radius/2.0f;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Value of a parameter of any kind
+union ParamValue {
+    int i;
+    float f;
+    bool b;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Runtime tunables by name (the ModelConfig field), for scenario files
+struct Param {
+    enum Kind {
+        Int,
+        Float,
+        Bool
+    };
+    const char* name;
+    Kind kind;
+    size_t offset; // of the field in ModelConfig
+
+    void* in(ModelConfig& ioConfig) const {
+        return (char*)&ioConfig + offset;
+    }
+    const void* in(const ModelConfig& iConfig) const {
+        return (const char*)&iConfig + offset;
+    }
+    ParamValue get(const ModelConfig& iConfig) const;
+    void set(ModelConfig& ioConfig, const ParamValue& iValue) const;
+    std::string toString(const ModelConfig& iConfig) const;
+    // Parses iValue into oValue (an int, float or bool according to kind)
+    bool parse(const std::string& iValue, void* oValue) const;
+    bool fromString(ModelConfig& ioConfig, const std::string& iValue) const {
+        return parse(iValue, in(ioConfig));
+    }
+};
+
+std::vector<Param>& getParams();
+Param* findParam(const std::string& iName);
@@ -0,0 +1,107 @@
+#pragma once
+#include "Vec2.h"
+#include <algorithm>
+#include <vector>
+
+enum ParticleType {
+    F,
+    A,
+    B,
+    S,
+    L
+};
+const int kNbParticleTypes = ParticleType::L+1;
+
+//////////////////////////////////////////////////////////////////////////////
+// Particles are stored as a structure of arrays, one contiguous array per field.
+// A particle is addressed by its index, indices stay compact: erasing a
+// particle moves the last one into the freed slot (swap and pop).
+// The view state (drawing shapes) is not part of the model.
+struct ParticleStore {
+    std::vector<Vec2f> position;
+    std::vector<Vec2f> velocity;
+    std::vector<float> orientation;
+    std::vector<Vec2f> heading; // (cos, sin) of orientation, see ModelConfig::complex_orientation
+    std::vector<float> angularVelocity;
+    std::vector<Vec2f> force;
+    std::vector<float> torque;
+    std::vector<ParticleType> type;
+    std::vector<int> spawnStep;
+    std::vector<int> cluster; // Id of its S cluster at the last analysis, -1 for none, see ClusterTracker
+
+    int size() const {
+        return (int)position.size();
+    }
+    bool empty() const {
+        return position.empty();
+    }
+    void reserve(int n) {
+        position.reserve(n);
+        velocity.reserve(n);
+        orientation.reserve(n);
+        heading.reserve(n);
+        angularVelocity.reserve(n);
+        force.reserve(n);
+        torque.reserve(n);
+        type.reserve(n);
+        spawnStep.reserve(n);
+        cluster.reserve(n);
+    }
+    // Room for iCount more particles, growing geometrically like push_back
+    void reserveMore(int iCount) {
+        if (size()+iCount > (int)position.capacity())
+            reserve(std::max(size()+iCount, 2*(int)position.capacity()));
+    }
+    int add(ParticleType iType, const Vec2f& iPosition, const Vec2f& iVelocity,
+            float iOrientation, int iSpawnStep) {
+        position.push_back(iPosition);
+        velocity.push_back(iVelocity);
+        orientation.push_back(iOrientation);
+        heading.push_back(Vec2f(std::cos(iOrientation), std::sin(iOrientation)));
+        angularVelocity.push_back(0.0f);
+        force.push_back(Vec2f(0.0, 0.0));
+        torque.push_back(0.0f);
+        type.push_back(iType);
+        spawnStep.push_back(iSpawnStep);
+        cluster.push_back(-1);
+        return size()-1;
+    }
+    // Moves the last particle into slot i and shrinks the store by one
+    void swapAndPop(int i) {
+        int last = size()-1;
+        if (i != last) {
+            position[i] = position[last];
+            velocity[i] = velocity[last];
+            orientation[i] = orientation[last];
+            heading[i] = heading[last];
+            angularVelocity[i] = angularVelocity[last];
+            force[i] = force[last];
+            torque[i] = torque[last];
+            type[i] = type[last];
+            spawnStep[i] = spawnStep[last];
+            cluster[i] = cluster[last];
+        }
+        position.pop_back();
+        velocity.pop_back();
+        orientation.pop_back();
+        heading.pop_back();
+        angularVelocity.pop_back();
+        force.pop_back();
+        torque.pop_back();
+        type.pop_back();
+        spawnStep.pop_back();
+        cluster.pop_back();
+    }
+    void clear() {
+        position.clear();
+        velocity.clear();
+        orientation.clear();
+        heading.clear();
+        angularVelocity.clear();
+        force.clear();
+        torque.clear();
+        type.clear();
+        spawnStep.clear();
+        cluster.clear();
+    }
+};
@@ -0,0 +1,433 @@
+#include "Plug.h"
+#include "Profiler.h"
+#include <numeric>
+
+//////////////////////////////////////////////////////////////////////////////
+Plug::Plug() {
+    configure(ModelConfig());
+    clear();
+    updateStencil();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Plug::updateStencil(float iRadius) {
+    if (stencilRadius == iRadius && stencilDx == cellWidth && stencilDy == cellHeight)
+        return;
+    stencilRadius = iRadius;
+    stencilDx = cellWidth;
+    stencilDy = cellHeight;
+    stencilNx = iRadius/cellWidth+1;
+    stencilNy = iRadius/cellHeight+1;
+    // The sparse half tiles depend on the stencil
+    if (sparse)
+        buildHalfTiles();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int Plug::halfTileCount(int iColour) const {
+    if (sparse)
+        return (int)halfTileStart[iColour].size()-1;
+    int nx = (nbCellsX+halfTileWidth()-1)/halfTileWidth();
+    int ny = (nbCellsY+halfTileHeight()-1)/halfTileHeight();
+    return ((nx-iColour%2+1)/2) * ((ny-iColour/2+1)/2);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Estimated cost of a step per particle, in distance computations
+static const float kRowCost = 4.0f; // setting up a row span
+static const float kSparseRowCost = 8.0f; // finding it in the hash table
+static const float kCellCost = 1.0f; // sweeping a cell of the dense grid
+static const int kMaxDenseCells = 1 << 22;
+static const float kSwitchGain = 0.8f;
+
+void Plug::configure(const ModelConfig& iConfig) {
+    worldWidth = iConfig.world_width;
+    worldHeight = iConfig.world_height;
+    sparseGrid = iConfig.sparse_grid;
+    interactionRadius = iConfig.interaction_radius;
+    setResolution(nbCellsX, nbCellsY);
+}
+
+void Plug::setResolution(int iNx, int iNy) {
+    nbCellsX = std::max(1, iNx);
+    nbCellsY = std::max(1, iNy);
+    cellWidth = (float)std::max(1, worldWidth)/nbCellsX;
+    cellHeight = (float)std::max(1, worldHeight)/nbCellsY;
+}
+
+void Plug::updateGrid(int iNbParticles, const ModelConfig& iConfig) {
+    configure(iConfig);
+    if (iConfig.auto_grid) {
+        float width = std::max(1, worldWidth);
+        float height = std::max(1, worldHeight);
+        // Largest distance searched in the grid
+        float cutoff = std::max(iConfig.interaction_radius, iConfig.reactionRadius());
+        if (iConfig.verlet_lists)
+            cutoff += std::max(0.0f, iConfig.verlet_skin);
+        cutoff = std::max(cutoff, 0.01f);
+        // Particles per unit area where there are particles
+        float density = nbOccupied > 0 ? iNbParticles/(nbOccupied*cellWidth*cellHeight) : iNbParticles/(width*height);
+        auto cost = [&](int iNx, int iNy) {
+            float dx = width/iNx;
+            float dy = height/iNy;
+            int sx = (int)(cutoff/dx)+1;
+            int sy = (int)(cutoff/dy)+1;
+            float halfStencil = 0.5f*density*(2*sx+1)*dx*(2*sy+1)*dy;
+            float rows = (sparseGrid ? kSparseRowCost : kRowCost)*(sy+1);
+            float cells = sparseGrid ? 0.0f : kCellCost*iNx*(float)iNy/std::max(1, iNbParticles);
+            return halfStencil + rows + cells;
+        };
+        int bestNx = nbCellsX;
+        int bestNy = nbCellsY;
+        float currentCost = cost(bestNx, bestNy);
+        float bestCost = currentCost;
+        // Cells just larger than a fraction of the cutoff, so that the stencil
+        // spans as few cells as possible, then larger cells for sparse populations
+        for (float size = cutoff/3.0f; size < 2.0f*std::max(width, height); size *= size < cutoff ? 1.5f : 2.0f) {
+            int nx = std::max(1, (int)std::ceil(width/size)-1);
+            int ny = std::max(1, (int)std::ceil(height/size)-1);
+            if (!sparseGrid && (long long)nx*ny > kMaxDenseCells)
+                continue;
+            float c = cost(nx, ny);
+            if (c < bestCost) {
+                bestCost = c;
+                bestNx = nx;
+                bestNy = ny;
+            }
+        }
+        if (bestCost < kSwitchGain*currentCost)
+            setResolution(bestNx, bestNy);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+float Plug::averageCandidates() const {
+    int nbCells = (int)cellStart.size()-1;
+    long long total = 0;
+    for (int k = 0; k < nbCells; ++k) {
+        int count = cellStart[k+1]-cellStart[k];
+        if (count == 0)
+            continue;
+        CellRange range = getNeighbourRange(k2ij(k));
+        for (int j = range.j0; j <= range.j1; ++j) {
+            int first, last;
+            getRowSpan(j, range.i0, range.i1, first, last);
+            total += (long long)count*(last-first);
+        }
+        total -= count;
+    }
+    return cellParticles.empty() ? 0.0f : (float)total/cellParticles.size();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Plug::rebuild(const std::vector<Vec2f>& iPositions, const std::vector<ParticleType>& iTypes,
+                   ThreadPool& ioPool) {
+    if (sparseGrid) {
+        rebuildSparse(iPositions, iTypes, ioPool);
+        return;
+    }
+    if (sparse)
+        particleCell.clear();
+    sparse = false;
+    gridNx = nbCellsX;
+    gridNy = nbCellsY;
+    int nbParticles = (int)iPositions.size();
+    int nbCells = nbCellsX*nbCellsY;
+    int nbChunks = nbParticles < 4096 ? 1 : ioPool.threadCount();
+    // Particles that kept their index since the last rebuild, for the migration count
+    int nbPrevious = std::min(nbParticles, (int)particleCell.size());
+    updateStencil();
+    particleCell.resize(nbParticles);
+    cellParticles.resize(nbParticles);
+    chunkOffsets.assign(nbChunks*nbCells, 0);
+    // Histograms
+    ioPool.parallelFor(nbChunks, [&](int c) {
+        int* counts = &chunkOffsets[c*nbCells];
+        long long migrations = 0;
+        for (int i = nbParticles*c/nbChunks; i < nbParticles*(c+1)/nbChunks; ++i) {
+            int k = ij2k(locate(iPositions[i]));
+            migrations += i < nbPrevious && particleCell[i] != k;
+            particleCell[i] = k;
+            ++counts[k];
+        }
+        g_profiler.count(Profiler::CellMigrations, migrations);
+    });
+    nbOccupied = sumChunks(nbCells, nbChunks, ioPool);
+    scatter(nbCells, nbChunks, iTypes, ioPool);
+}
+
+// Counts of the cells in cellStart and of each range of cells in rangeOffsets,
+// summed over the chunk histograms. The ranges are split over the pool and each
+// histogram is read along its row. Returns the occupied cells.
+int Plug::sumChunks(int iNbCells, int iNbChunks, ThreadPool& ioPool) {
+    int nbRanges = iNbChunks;
+    cellStart.assign(iNbCells+1, 0);
+    rangeOffsets.assign(nbRanges+1, 0);
+    std::vector<int> occupied(nbRanges, 0);
+    ioPool.parallelFor(nbRanges, [&](int r) {
+        int k0 = (int)((long long)iNbCells*r/nbRanges);
+        int k1 = (int)((long long)iNbCells*(r+1)/nbRanges);
+        for (int c = 0; c < iNbChunks; ++c) {
+            const int* counts = &chunkOffsets[(size_t)c*iNbCells];
+            for (int k = k0; k < k1; ++k)
+                cellStart[k] += counts[k];
+        }
+        int total = 0;
+        for (int k = k0; k < k1; ++k) {
+            total += cellStart[k];
+            occupied[r] += cellStart[k] > 0;
+        }
+        rangeOffsets[r+1] = total;
+    });
+    std::partial_sum(rangeOffsets.begin(), rangeOffsets.end(), rangeOffsets.begin());
+    return std::accumulate(occupied.begin(), occupied.end(), 0);
+}
+
+// Prefix sum of the counts of sumChunks(), per range of cells from its offset:
+// the chunk histograms become the write offsets of each chunk, then scatter of
+// the particles and their types
+void Plug::scatter(int iNbCells, int iNbChunks, const std::vector<ParticleType>& iTypes, ThreadPool& ioPool) {
+    int nbParticles = (int)particleCell.size();
+    int nbRanges = (int)rangeOffsets.size()-1;
+    ioPool.parallelFor(nbRanges, [&](int r) {
+        int k0 = (int)((long long)iNbCells*r/nbRanges);
+        int k1 = (int)((long long)iNbCells*(r+1)/nbRanges);
+        // End of each cell, then back to its start through the chunks in reverse
+        int offset = rangeOffsets[r];
+        for (int k = k0; k < k1; ++k) {
+            offset += cellStart[k];
+            cellStart[k] = offset;
+        }
+        for (int c = iNbChunks-1; c >= 0; --c) {
+            int* counts = &chunkOffsets[(size_t)c*iNbCells];
+            for (int k = k0; k < k1; ++k) {
+                cellStart[k] -= counts[k];
+                counts[k] = cellStart[k];
+            }
+        }
+    });
+    cellStart[iNbCells] = rangeOffsets[nbRanges];
+    cellTypes.resize(nbParticles);
+    ioPool.parallelFor(iNbChunks, [&](int c) {
+        int* cursor = &chunkOffsets[c*iNbCells];
+        for (int i = nbParticles*c/iNbChunks; i < nbParticles*(c+1)/iNbChunks; ++i) {
+            int s = cursor[particleCell[i]]++;
+            cellParticles[s] = i;
+            cellTypes[s] = iTypes[i];
+        }
+    });
+    sortByType(ioPool);
+}
+
+// Stable sort of every cell by type, the particles of a type stay in index
+// order: insertion for the few particles of most cells, counting sort beyond
+void Plug::sortByType(ThreadPool& ioPool) {
+    const int kInsertionMax = 16;
+    int nbCells = (int)cellStart.size()-1;
+    int nbChunks = cellParticles.size() < 4096 ? 1 : ioPool.threadCount();
+    ioPool.parallelFor(nbChunks, [&](int c) {
+        std::vector<int> particles;
+        std::vector<ParticleType> types;
+        for (int k = nbCells*c/nbChunks; k < nbCells*(c+1)/nbChunks; ++k) {
+            int first = cellStart[k];
+            int last = cellStart[k+1];
+            if (last-first <= kInsertionMax) {
+                for (int s = first+1; s < last; ++s) {
+                    int p = cellParticles[s];
+                    ParticleType t = cellTypes[s];
+                    int hole = s;
+                    for (; hole > first && cellTypes[hole-1] > t; --hole) {
+                        cellParticles[hole] = cellParticles[hole-1];
+                        cellTypes[hole] = cellTypes[hole-1];
+                    }
+                    cellParticles[hole] = p;
+                    cellTypes[hole] = t;
+                }
+                continue;
+            }
+            int offsets[kNbParticleTypes] = {};
+            for (int s = first; s < last; ++s)
+                ++offsets[cellTypes[s]];
+            for (int t = 0, offset = first; t < kNbParticleTypes; ++t) {
+                int count = offsets[t];
+                offsets[t] = offset;
+                offset += count;
+            }
+            particles.assign(cellParticles.begin()+first, cellParticles.begin()+last);
+            types.assign(cellTypes.begin()+first, cellTypes.begin()+last);
+            for (int n = 0; n < last-first; ++n) {
+                int s = offsets[types[n]]++;
+                cellParticles[s] = particles[n];
+                cellTypes[s] = types[n];
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static int floorDiv(int a, int b) {
+    return a >= 0 ? a/b : -((b-1-a)/b);
+}
+
+// Same steps as the dense rebuild over the cells of the last layout, which is
+// only remade when a particle left it or when half of its occupied cells are empty
+void Plug::rebuildSparse(const std::vector<Vec2f>& iPositions, const std::vector<ParticleType>& iTypes,
+                         ThreadPool& ioPool) {
+    int nbParticles = (int)iPositions.size();
+    int nbChunks = nbParticles < 4096 ? 1 : ioPool.threadCount();
+    bool relayout = !sparse;
+    int nbPrevious = sparse ? std::min(nbParticles, (int)particleKey.size()) : 0;
+    sparse = true;
+    gridNx = 0;
+    gridNy = 0;
+    updateStencil();
+    particleKey.resize(nbParticles);
+    particleCell.resize(nbParticles);
+    cellParticles.resize(nbParticles);
+    ioPool.parallelFor(nbChunks, [&](int c) {
+        long long migrations = 0;
+        for (int i = nbParticles*c/nbChunks; i < nbParticles*(c+1)/nbChunks; ++i) {
+            Vec2i ij = locate(iPositions[i]);
+            int64_t key = CellHash::key(ij.x, ij.y);
+            migrations += i < nbPrevious && particleKey[i] != key;
+            particleKey[i] = key;
+        }
+        g_profiler.count(Profiler::CellMigrations, migrations);
+    });
+    if (!relayout)
+        relayout = !countSparse(nbChunks, ioPool);
+    if (!relayout) {
+        nbOccupied = sumChunks((int)cellCoords.size(), nbChunks, ioPool);
+        relayout = 2*nbOccupied < nbLayoutOccupied;
+    }
+    if (relayout) {
+        layoutCells(iPositions);
+        countSparse(nbChunks, ioPool);
+        nbOccupied = sumChunks((int)cellCoords.size(), nbChunks, ioPool);
+    }
+    scatter((int)cellCoords.size(), nbChunks, iTypes, ioPool);
+}
+
+// Histograms over the cells of the layout, false when a particle is outside of them
+bool Plug::countSparse(int iNbChunks, ThreadPool& ioPool) {
+    int nbParticles = (int)particleKey.size();
+    int nbCells = (int)cellCoords.size();
+    chunkOffsets.assign(iNbChunks*nbCells, 0);
+    std::vector<char> complete(iNbChunks, 1);
+    ioPool.parallelFor(iNbChunks, [&](int c) {
+        int* counts = &chunkOffsets[c*nbCells];
+        for (int i = nbParticles*c/iNbChunks; i < nbParticles*(c+1)/iNbChunks; ++i) {
+            int k = cellIndex.find(particleKey[i]);
+            if (k < 0) {
+                complete[c] = 0;
+                return;
+            }
+            particleCell[i] = k;
+            ++counts[k];
+        }
+    });
+    return std::find(complete.begin(), complete.end(), 0) == complete.end();
+}
+
+// Occupied cells and the cells around them sorted by row then column, their
+// rows and half tiles
+void Plug::layoutCells(const std::vector<Vec2f>& iPositions) {
+    int nbParticles = (int)particleKey.size();
+    cellIndex.reset((int)cellCoords.size());
+    unsortedCoords.clear();
+    for (int i = 0; i < nbParticles; ++i) {
+        int nbCells = (int)unsortedCoords.size();
+        if (cellIndex.insert(particleKey[i], nbCells) == nbCells)
+            unsortedCoords.push_back(locate(iPositions[i]));
+    }
+    nbLayoutOccupied = (int)unsortedCoords.size();
+    for (int k = 0; k < nbLayoutOccupied; ++k)
+        for (int dj = -1; dj <= 1; ++dj)
+            for (int di = -1; di <= 1; ++di) {
+                Vec2i ij = unsortedCoords[k] + Vec2i{ di,dj };
+                int nbCells = (int)unsortedCoords.size();
+                if (cellIndex.insert(CellHash::key(ij.x, ij.y), nbCells) == nbCells)
+                    unsortedCoords.push_back(ij);
+            }
+    int nbCells = (int)unsortedCoords.size();
+    cellOrder.resize(nbCells);
+    std::iota(cellOrder.begin(), cellOrder.end(), 0);
+    std::sort(cellOrder.begin(), cellOrder.end(), [this](int a, int b) {
+        const Vec2i& ca = unsortedCoords[a];
+        const Vec2i& cb = unsortedCoords[b];
+        return ca.y < cb.y || (ca.y == cb.y && ca.x < cb.x);
+    });
+    cellRank.resize(nbCells);
+    cellCoords.resize(nbCells);
+    for (int k = 0; k < nbCells; ++k) {
+        cellRank[cellOrder[k]] = k;
+        cellCoords[k] = unsortedCoords[cellOrder[k]];
+    }
+    cellIndex.remap(cellRank);
+    rowStart.clear();
+    for (int k = 0; k < nbCells; ++k)
+        if (k == 0 || cellCoords[k].y != cellCoords[k-1].y)
+            rowStart.push_back(k);
+    rowStart.push_back(nbCells);
+    buildHalfTiles();
+}
+
+// Occupied cells grouped by half tile, colour after colour
+void Plug::buildHalfTiles() {
+    int nbCells = (int)cellCoords.size();
+    int width = halfTileWidth();
+    int height = halfTileHeight();
+    cellTiles.resize(nbCells);
+    for (int k = 0; k < nbCells; ++k)
+        cellTiles[k] = Vec2i{ floorDiv(cellCoords[k].x, width), floorDiv(cellCoords[k].y, height) };
+    auto colourOf = [this](int k) {
+        return (cellTiles[k].x & 1) + 2*(cellTiles[k].y & 1);
+    };
+    halfTileCells.resize(nbCells);
+    std::iota(halfTileCells.begin(), halfTileCells.end(), 0);
+    std::sort(halfTileCells.begin(), halfTileCells.end(), [&](int a, int b) {
+        int colourA = colourOf(a);
+        int colourB = colourOf(b);
+        if (colourA != colourB)
+            return colourA < colourB;
+        const Vec2i& ta = cellTiles[a];
+        const Vec2i& tb = cellTiles[b];
+        return ta.y < tb.y || (ta.y == tb.y && (ta.x < tb.x || (ta.x == tb.x && a < b)));
+    });
+    for (std::vector<int>& start : halfTileStart)
+        start.clear();
+    for (int c = 0; c < nbCells; ++c) {
+        int k = halfTileCells[c];
+        if (c == 0 || colourOf(k) != colourOf(halfTileCells[c-1])
+            || cellTiles[k].x != cellTiles[halfTileCells[c-1]].x
+            || cellTiles[k].y != cellTiles[halfTileCells[c-1]].y)
+            halfTileStart[colourOf(k)].push_back(c);
+    }
+    // End of the last tile of each colour, the start of the next colour
+    int end = nbCells;
+    for (int colour = 3; colour >= 0; --colour) {
+        std::vector<int>& start = halfTileStart[colour];
+        start.push_back(end);
+        end = start.front();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Plug::clear() {
+    sparse = sparseGrid;
+    gridNx = sparse ? 0 : nbCellsX;
+    gridNy = sparse ? 0 : nbCellsY;
+    cellStart.assign(sparse ? 1 : nbCellsX*nbCellsY+1, 0);
+    cellParticles.clear();
+    cellTypes.clear();
+    particleCell.clear();
+    particleKey.clear();
+    nbOccupied = 0;
+    cellCoords.clear();
+    nbLayoutOccupied = 0;
+    rowStart.assign(1, 0);
+    halfTileCells.clear();
+    for (std::vector<int>& start : halfTileStart)
+        start.assign(1, 0);
+    cellIndex.reset(0);
+}
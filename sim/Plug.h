@@ -0,0 +1,322 @@
+#pragma once
+#include "CellHash.h"
+#include "Params.h"
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include "Vec2.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Indices of the particles of one cell, a contiguous range of Plug::cellParticles
+struct Cell {
+    const int* first;
+    const int* last;
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    int size() const { return (int)(last-first); }
+};
+
+// Inclusive block of cells [i0,i1]x[j0,j1]
+struct CellRange {
+    int i0, i1, j0, j1;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Uniform grid rebuilt once per step with a counting sort:
+// cellParticles holds the particle indices ordered by cell and the particles
+// of cell k are cellParticles[cellStart[k]] to cellParticles[cellStart[k+1]-1]
+// Within a cell the particles are sorted by type and cellTypes follows them,
+// pair loops skip the types that do not interact without reading the particles.
+// Two layouts, chosen by the sparse_grid param at each rebuild:
+// - dense: the nbCellsX x nbCellsY cells of the world, cell k = nbCellsX*j+i,
+//   particles outside of the world go to the border cells
+// - sparse: only the occupied cells of the unbounded plane, sorted by row then
+//   column and found through a hash table on their coordinates. Memory follows
+//   the occupied cells, not the world size. The layout also holds the cells
+//   around the occupied ones, so it only changes when a particle moves further
+//   than one cell or when half of the occupied cells are emptied.
+// The rest of the interface does not depend on the layout.
+struct Plug
+{
+    std::vector<int> cellStart;
+    std::vector<int> cellParticles;
+    std::vector<ParticleType> cellTypes; // Type of the particle at each slot of cellParticles
+    std::vector<int> particleCell; // Cell of each particle at the last rebuild
+    std::vector<int> chunkOffsets;
+    std::vector<int> rangeOffsets; // first slot of each range of cells of sumChunks(), and the end
+    // Settings of the next rebuild, see configure() and updateGrid()
+    int worldWidth = 1;
+    int worldHeight = 1;
+    int nbCellsX = 50; // Resolution of the dense grid
+    int nbCellsY = 50;
+    float cellWidth = 1.0f;
+    float cellHeight = 1.0f;
+    float interactionRadius = 1.0f;
+    bool sparseGrid = false;
+    int stencilNx = 0;
+    int stencilNy = 0;
+    float stencilRadius = -1.0f;
+    float stencilDx = -1.0f;
+    float stencilDy = -1.0f;
+    // Layout of the last rebuild
+    int nbOccupied = 0; // cells holding particles
+    bool sparse = false;
+    int gridNx = 0;
+    int gridNy = 0;
+    // Sparse layout
+    std::vector<Vec2i> cellCoords; // of each cell of the layout
+    int nbLayoutOccupied = 0; // occupied cells when the layout was made
+    std::vector<int> rowStart; // first cell of each row of the layout, and the end
+    std::vector<int> halfTileCells; // cells grouped by half tile, colour after colour
+    std::vector<int> halfTileStart[4]; // per colour, tile t is halfTileCells[halfTileStart[t]] to [halfTileStart[t+1]-1]
+    CellHash cellIndex; // (i,j) -> cell of the layout
+    std::vector<int64_t> particleKey; // CellHash::key of each particle
+    std::vector<Vec2i> unsortedCoords;
+    std::vector<Vec2i> cellTiles;
+    std::vector<int> cellRank;
+    std::vector<int> cellOrder;
+
+    Plug();
+
+    int ij2k(const Vec2i& ij) const{
+        return nbCellsX*ij.y+ij.x;
+    }
+    Vec2i k2ij(int k) const {
+        if (sparse)
+            return cellCoords[k];
+        int i = k % nbCellsX;
+        int j = (k-i)/nbCellsX;
+        return Vec2i{ i,j };
+    }
+
+    Vec2i locate(const Vec2f& pos) const {
+        Vec2i ij;
+        ij.x = floor((pos.x+.5*worldWidth)/cellWidth);
+        ij.y = floor((pos.y+.5*worldHeight)/cellHeight);
+        if (sparse)
+            return ij;
+        // Outside of the world particles go to the border cells
+        ij.x = std::max(0, std::min(nbCellsX-1, ij.x));
+        ij.y = std::max(0, std::min(nbCellsY-1, ij.y));
+        return ij;
+    }
+    // Cell of coordinates (i,j), -1 when it is not in the sparse layout
+    int findCell(int i, int j) const {
+        return sparse ? cellIndex.find(CellHash::key(i, j)) : nbCellsX*j+i;
+    }
+    Cell getCell(int k) const {
+        const int* data = cellParticles.data();
+        return Cell{ data+cellStart[k], data+cellStart[k+1] };
+    }
+    // Stencil half extents in cells, only recomputed when the interaction
+    // radius or the cell size change
+    void updateStencil() {
+        updateStencil(interactionRadius);
+    }
+    void updateStencil(float iRadius);
+    // Block of cells around cell ij covered by the stencil, clamped to the grid
+    // in the dense layout
+    CellRange getNeighbourRange(const Vec2i& ij) const {
+        CellRange range;
+        range.i0 = ij.x-stencilNx;
+        range.i1 = ij.x+stencilNx;
+        range.j0 = ij.y-stencilNy;
+        range.j1 = ij.y+stencilNy;
+        if (!sparse) {
+            range.i0 = std::max(0, range.i0);
+            range.i1 = std::min(nbCellsX-1, range.i1);
+            range.j0 = std::max(0, range.j0);
+            range.j1 = std::min(nbCellsY-1, range.j1);
+        }
+        return range;
+    }
+    CellRange getNeighbourRange(const Vec2f& pos) const {
+        return getNeighbourRange(locate(pos));
+    }
+    // Cell after the last one of row j up to column i1, from cell k0 of row j
+    int rowEnd(int k0, int j, int i1) const {
+        if (!sparse)
+            return nbCellsX*j+i1+1;
+        int k1 = k0+1;
+        int nbCells = (int)cellCoords.size();
+        while (k1 < nbCells && cellCoords[k1].y == j && cellCoords[k1].x <= i1)
+            ++k1;
+        return k1;
+    }
+    // Slots [oFirst,oLast) of the particles of the cells [i0,i1] of row j
+    // The cells of a row are consecutive in cellParticles in both layouts, so
+    // they are a single span. In the sparse layout it starts at the first cell
+    // of the layout found from i0.
+    void getRowSpan(int j, int i0, int i1, int& oFirst, int& oLast) const {
+        int k0 = -1;
+        for (int i = i0; i <= i1 && k0 < 0; ++i)
+            k0 = findCell(i, j);
+        if (k0 < 0) {
+            oFirst = oLast = 0;
+            return;
+        }
+        oFirst = cellStart[k0];
+        oLast = cellStart[rowEnd(k0, j, i1)];
+    }
+    // Calls f(p) for every particle of the cells [i0,i1] of row j
+    template<typename Function>
+    void forEachInRow(int j, int i0, int i1, Function f) const {
+        int first, last;
+        getRowSpan(j, i0, i1, first, last);
+        const int* data = cellParticles.data();
+        for (const int* it = data+first; it != data+last; ++it)
+            f(*it);
+    }
+    // Calls f(other) for every particle of the cells around pos, without allocating
+    template<typename Function>
+    void forEachNeighbour(const Vec2f& pos, Function f) const {
+        CellRange range = getNeighbourRange(pos);
+        for (int j = range.j0; j <= range.j1; ++j)
+            forEachInRow(j, range.i0, range.i1, f);
+    }
+    // Half stencil of the particle stored at slot iSlot of cell (i,j): the particles
+    // after it in its own row span and the full spans of the next stencilNy rows.
+    // Each pair of the full stencil is visited once, writes only reach rows j to j+stencilNy.
+    template<typename Function>
+    void forEachHalfNeighbour(int iSlot, int i, int j, Function f) const {
+        const int* data = cellParticles.data();
+        int i0 = i-stencilNx;
+        int i1 = i+stencilNx;
+        int j1 = j+stencilNy;
+        if (!sparse) {
+            i0 = std::max(0, i0);
+            i1 = std::min(nbCellsX-1, i1);
+            j1 = std::min(nbCellsY-1, j1);
+        }
+        const int* last = data+cellStart[rowEnd(findCell(i, j), j, i1)];
+        for (const int* it = data+iSlot+1; it < last; ++it)
+            f(*it);
+        for (int jj = j+1; jj <= j1; ++jj)
+            forEachInRow(jj, i0, i1, f);
+    }
+    // Calls f(other, type) for the particles of slots [iFirst,iLast) whose type
+    // is in iTypeMask (bit t)
+    template<typename Function>
+    void forEachOfTypes(int iFirst, int iLast, unsigned iTypeMask, Function f) const {
+        for (int s = iFirst; s < iLast; ++s)
+            if (iTypeMask & (1u << cellTypes[s]))
+                f(cellParticles[s], cellTypes[s]);
+    }
+    // forEachNeighbour() restricted to the types of iTypeMask, f(other, type)
+    template<typename Function>
+    void forEachNeighbourOfTypes(const Vec2f& pos, unsigned iTypeMask, Function f) const {
+        CellRange range = getNeighbourRange(pos);
+        for (int j = range.j0; j <= range.j1; ++j) {
+            int first, last;
+            getRowSpan(j, range.i0, range.i1, first, last);
+            forEachOfTypes(first, last, iTypeMask, f);
+        }
+    }
+    // forEachHalfNeighbour() restricted to the types of iTypeMask, f(other, type)
+    template<typename Function>
+    void forEachHalfNeighbourOfTypes(int iSlot, int i, int j, unsigned iTypeMask, Function f) const {
+        int i0 = i-stencilNx;
+        int i1 = i+stencilNx;
+        int j1 = j+stencilNy;
+        if (!sparse) {
+            i0 = std::max(0, i0);
+            i1 = std::min(nbCellsX-1, i1);
+            j1 = std::min(nbCellsY-1, j1);
+        }
+        forEachOfTypes(iSlot+1, cellStart[rowEnd(findCell(i, j), j, i1)], iTypeMask, f);
+        for (int jj = j+1; jj <= j1; ++jj) {
+            int first, last;
+            getRowSpan(jj, i0, i1, first, last);
+            forEachOfTypes(first, last, iTypeMask, f);
+        }
+    }
+    // Tiles for the half stencil: at least 2*stencilNx columns by stencilNy rows,
+    // in four colours so that tiles of one colour never write the same particle
+    int halfTileWidth() const {
+        return 2*stencilNx;
+    }
+    int halfTileHeight() const {
+        return std::max(1, stencilNy);
+    }
+    int halfTileCount(int iColour) const;
+    // Calls f(p, slot, i, j) for every particle of tile t of colour iColour
+    template<typename Function>
+    void forEachInHalfTile(int iColour, int t, Function f) const {
+        if (sparse) {
+            const std::vector<int>& start = halfTileStart[iColour];
+            for (int c = start[t]; c < start[t+1]; ++c) {
+                int k = halfTileCells[c];
+                for (int slot = cellStart[k]; slot < cellStart[k+1]; ++slot)
+                    f(cellParticles[slot], slot, cellCoords[k].x, cellCoords[k].y);
+            }
+            return;
+        }
+        int nx = (nbCellsX+halfTileWidth()-1)/halfTileWidth();
+        int nxColour = (nx-iColour%2+1)/2;
+        int a = iColour%2 + 2*(t%nxColour);
+        int b = iColour/2 + 2*(t/nxColour);
+        int i0 = a*halfTileWidth();
+        int i1 = std::min(nbCellsX, i0+halfTileWidth());
+        int j0 = b*halfTileHeight();
+        int j1 = std::min(nbCellsY, j0+halfTileHeight());
+        for (int j = j0; j < j1; ++j)
+            for (int i = i0; i < i1; ++i) {
+                int k = nbCellsX*j+i;
+                for (int slot = cellStart[k]; slot < cellStart[k+1]; ++slot)
+                    f(cellParticles[slot], slot, i, j);
+            }
+    }
+    // World, layout and interaction radius of iConfig for the next rebuilds,
+    // the cell size follows the world size
+    void configure(const ModelConfig& iConfig);
+    // Fixed number of cells, kept until updateGrid() picks another one
+    void setResolution(int iNx, int iNy);
+    // configure() then the grid resolution for the next rebuild: with
+    // auto_grid, the cell size giving the fewest estimated operations per
+    // particle for the current cutoff and density, kept unless another one is
+    // clearly better.
+    void updateGrid(int iNbParticles, const ModelConfig& iConfig);
+    // Particles in the full stencil of a particle, itself excluded, on average
+    float averageCandidates() const;
+    // Counting sort of the particles by cell, no allocation once the sizes are reached
+    // Large populations are sorted in chunks: every chunk builds its own histogram,
+    // the prefix sum interleaves them per cell so the result does not depend on
+    // the number of chunks
+    void rebuild(const std::vector<Vec2f>& iPositions, const std::vector<ParticleType>& iTypes, ThreadPool& ioPool);
+    // Work is split over tiles of one grid row (occupied row in the sparse layout),
+    // the particles of a tile are contiguous in cellParticles
+    int tileCount() const {
+        return sparse ? (int)rowStart.size()-1 : nbCellsY;
+    }
+    Cell getTile(int t) const {
+        const int* data = cellParticles.data();
+        if (sparse)
+            return Cell{ data+cellStart[rowStart[t]], data+cellStart[rowStart[t+1]] };
+        return Cell{ data+cellStart[nbCellsX*t], data+cellStart[nbCellsX*(t+1)] };
+    }
+    // Calls f(p, slot, i, j) for every particle of tile t
+    template<typename Function>
+    void forEachInTile(int t, Function f) const {
+        int k0 = sparse ? rowStart[t] : nbCellsX*t;
+        int k1 = sparse ? rowStart[t+1] : nbCellsX*(t+1);
+        for (int k = k0; k < k1; ++k) {
+            Vec2i ij = k2ij(k);
+            for (int slot = cellStart[k]; slot < cellStart[k+1]; ++slot)
+                f(cellParticles[slot], slot, ij.x, ij.y);
+        }
+    }
+    void clear();
+
+private:
+    int sumChunks(int iNbCells, int iNbChunks, ThreadPool& ioPool);
+    void scatter(int iNbCells, int iNbChunks, const std::vector<ParticleType>& iTypes, ThreadPool& ioPool);
+    void sortByType(ThreadPool& ioPool);
+    void rebuildSparse(const std::vector<Vec2f>& iPositions, const std::vector<ParticleType>& iTypes,
+                       ThreadPool& ioPool);
+    bool countSparse(int iNbChunks, ThreadPool& ioPool);
+    void layoutCells(const std::vector<Vec2f>& iPositions);
+    void buildHalfTiles();
+};
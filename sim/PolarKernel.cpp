@@ -0,0 +1,190 @@
+#include "PolarKernel.h"
+#include "Params.h"
+#ifdef PARTICLELIFE_AVX2
+#include <immintrin.h>
+//////////////////////////////////////////////////////////////////////////////
+// AVX2 versions of the few transcendental functions of the polar kernel,
+// Cephes style polynomials, single precision
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+// Branch free wrap into [-pi, pi]
+AVX2_TARGET static inline __m256 wrapAngle8(__m256 x) {
+    const __m256 twoPi = _mm256_set1_ps(2.0f*M_PI);
+    const __m256 invTwoPi = _mm256_set1_ps(1.0f/(2.0f*M_PI));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, invTwoPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    return _mm256_fnmadd_ps(n, twoPi, x);
+}
+
+// x in [-pi, pi]
+AVX2_TARGET static inline void sincos8(__m256 x, __m256& oSin, __m256& oCos) {
+    __m256 j = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(2.0f/M_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 y = _mm256_fnmadd_ps(j, _mm256_set1_ps(1.5707963705062866f), x);
+    y = _mm256_fnmadd_ps(j, _mm256_set1_ps(-4.371139000186243e-08f), y);
+    __m256 z = _mm256_mul_ps(y, y);
+    __m256 s = _mm256_fmadd_ps(_mm256_set1_ps(-1.9515295891e-4f), z, _mm256_set1_ps(8.3321608736e-3f));
+    s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+    s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), y, y);
+    __m256 c = _mm256_fmadd_ps(_mm256_set1_ps(2.443315711809948e-5f), z, _mm256_set1_ps(-1.388731625493765e-3f));
+    c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+    c = _mm256_mul_ps(_mm256_mul_ps(c, z), z);
+    c = _mm256_add_ps(_mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, _mm256_set1_ps(1.0f)), c);
+    // Quadrant
+    __m256i q = _mm256_and_si256(_mm256_cvtps_epi32(j), _mm256_set1_epi32(3));
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 sinNeg = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+    __m256 cosNeg = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+    oSin = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sinNeg);
+    oCos = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosNeg);
+}
+
+AVX2_TARGET static inline __m256 atan2_8(__m256 y, __m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_andnot_ps(signMask, x);
+    __m256 ay = _mm256_andnot_ps(signMask, y);
+    __m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+    __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), mx);
+    // atan on [0, 1], reduced around pi/4 above tan(pi/8)
+    __m256 big = _mm256_cmp_ps(a, _mm256_set1_ps(0.41421356f), _CMP_GT_OQ);
+    __m256 t = _mm256_blendv_ps(a, _mm256_div_ps(_mm256_sub_ps(a, _mm256_set1_ps(1.0f)), _mm256_add_ps(a, _mm256_set1_ps(1.0f))), big);
+    __m256 z = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_fmadd_ps(_mm256_set1_ps(8.05374449538e-2f), z, _mm256_set1_ps(-1.38776856032e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.99777106478e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33329491539e-1f));
+    __m256 r = _mm256_fmadd_ps(_mm256_mul_ps(p, z), t, t);
+    r = _mm256_add_ps(r, _mm256_and_ps(big, _mm256_set1_ps(M_PI/4.0f)));
+    // Octant
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(M_PI/2.0f), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(M_PI), r), x);
+    return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+}
+
+// x > 0
+AVX2_TARGET static inline __m256 log8(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+    // Mantissa in [0.5, 1)
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f000000)));
+    __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+    m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), _mm256_set1_ps(1.0f));
+    __m256 z = _mm256_mul_ps(m, m);
+    __m256 p = _mm256_set1_ps(7.0376836292e-2f);
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.1514610310e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.1676998740e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.2420140846e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(1.4249322787e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-1.6668057665e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(2.0000714765e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(-2.4999993993e-1f));
+    p = _mm256_fmadd_ps(p, m, _mm256_set1_ps(3.3333331174e-1f));
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, m), z);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+    y = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, y);
+    return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), _mm256_add_ps(m, y));
+}
+
+AVX2_TARGET static inline __m256 exp8(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 fx = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_add_ps(_mm256_fmadd_ps(y, z, x), _mm256_set1_ps(1.0f));
+    __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Same rules as Model::calculateForceAndTorque_polar1, 8 pairs at a time and
+// without branches. The angle offsets of the torque rule never need wrapping
+// since teta is in [-pi, pi] and div_angle is small.
+AVX2_TARGET void calculateForceAndTorque_polar1_avx2(PolarBatch& ioBatch, const ModelConfig& iConfig) {
+    const __m256 pi = _mm256_set1_ps(M_PI);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const float oppositionSp = 0.1f;
+    ioBatch.pad();
+    __m256 rx = _mm256_load_ps(ioBatch.rx);
+    __m256 ry = _mm256_load_ps(ioBatch.ry);
+    __m256 rNorm = _mm256_load_ps(ioBatch.rNorm);
+    __m256 o1 = _mm256_set1_ps(ioBatch.orientation1);
+    __m256 o2 = _mm256_load_ps(ioBatch.orientation2);
+
+    __m256 teta = wrapAngle8(_mm256_sub_ps(o2, o1));
+    __m256 angleR = atan2_8(ry, rx);
+    __m256 phi = wrapAngle8(_mm256_sub_ps(angleR, o1));
+    __m256 antiPhi = wrapAngle8(_mm256_sub_ps(_mm256_add_ps(angleR, pi), o2));
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 opposition = _mm256_max_ps(_mm256_andnot_ps(signMask, phi), _mm256_andnot_ps(signMask, antiPhi));
+
+    // -1 below the threshold, 1 above, linear in between
+    __m256 anisoFactor = _mm256_mul_ps(_mm256_sub_ps(opposition, _mm256_set1_ps(iConfig.opposition_threshold-oppositionSp)),
+                                       _mm256_set1_ps(1.0f/oppositionSp));
+    anisoFactor = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(anisoFactor, one), _mm256_set1_ps(-1.0f)), one);
+
+    __m256 rotatorFactor, unused;
+    sincos8(wrapAngle8(_mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(phi, phi), teta), pi)), rotatorFactor, unused);
+    __m256 distanceFactor = exp8(_mm256_mul_ps(_mm256_set1_ps(-iConfig.s_f_exp_power), log8(rNorm)));
+
+    __m256 sinRot, cosRot;
+    sincos8(rotatorFactor, sinRot, cosRot);
+    __m256 scale = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(10.0f), rotatorFactor), rotatorFactor, one);
+    scale = _mm256_mul_ps(_mm256_mul_ps(scale, _mm256_set1_ps(iConfig.s_f_strength)), _mm256_mul_ps(anisoFactor, distanceFactor));
+    __m256 fx = _mm256_mul_ps(_mm256_fmsub_ps(rx, cosRot, _mm256_mul_ps(ry, sinRot)), scale);
+    __m256 fy = _mm256_mul_ps(_mm256_fmadd_ps(rx, sinRot, _mm256_mul_ps(ry, cosRot)), scale);
+
+    // Left/right of the mid angle
+    __m256 sinMid, cosMid;
+    sincos8(wrapAngle8(_mm256_fmadd_ps(teta, half, o1)), sinMid, cosMid);
+    __m256 side = _mm256_fmsub_ps(rx, sinMid, _mm256_mul_ps(ry, cosMid));
+    __m256 divAngle = _mm256_set1_ps(iConfig.div_angle);
+    __m256 minusDivAngle = _mm256_set1_ps(-iConfig.div_angle);
+    __m256 isLeft = _mm256_cmp_ps(side, _mm256_setzero_ps(), _CMP_GT_OQ);
+    __m256 isLeftOther = _mm256_cmp_ps(side, _mm256_setzero_ps(), _CMP_LT_OQ);
+    __m256 positive = _mm256_blendv_ps(_mm256_cmp_ps(teta, divAngle, _CMP_GT_OQ),
+                                       _mm256_cmp_ps(teta, minusDivAngle, _CMP_GT_OQ), isLeft);
+    __m256 positiveOther = _mm256_blendv_ps(_mm256_cmp_ps(teta, minusDivAngle, _CMP_LT_OQ),
+                                            _mm256_cmp_ps(teta, divAngle, _CMP_LT_OQ), isLeftOther);
+    __m256 torqueScale = _mm256_div_ps(_mm256_set1_ps(iConfig.s_t_strength), rNorm);
+    __m256 torque = _mm256_xor_ps(torqueScale, _mm256_andnot_ps(positive, signMask));
+    __m256 otherTorque = _mm256_xor_ps(torqueScale, _mm256_andnot_ps(positiveOther, signMask));
+
+    //Mutual viscosity system
+    __m256 fViscosity = _mm256_set1_ps(0.5f*iConfig.s_f_viscosity);
+    __m256 tViscosity = _mm256_set1_ps(0.5f*iConfig.s_t_viscosity);
+    fx = _mm256_fmadd_ps(_mm256_sub_ps(_mm256_load_ps(ioBatch.v2x), _mm256_set1_ps(ioBatch.v1x)), fViscosity, fx);
+    fy = _mm256_fmadd_ps(_mm256_sub_ps(_mm256_load_ps(ioBatch.v2y), _mm256_set1_ps(ioBatch.v1y)), fViscosity, fy);
+    __m256 dw = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(ioBatch.w2), _mm256_set1_ps(ioBatch.w1)), tViscosity);
+    torque = _mm256_add_ps(torque, dw);
+    otherTorque = _mm256_sub_ps(otherTorque, dw);
+
+    //Solid repulsion
+    __m256 q = _mm256_div_ps(_mm256_set1_ps(2.0f*DOT_SIZE), rNorm);
+    __m256 q2 = _mm256_mul_ps(q, q);
+    __m256 q4 = _mm256_mul_ps(q2, q2);
+    __m256 q9 = _mm256_mul_ps(_mm256_mul_ps(q4, q4), q);
+    q9 = _mm256_and_ps(q9, _mm256_cmp_ps(rNorm, _mm256_set1_ps(2.0f*2.0f*DOT_SIZE), _CMP_LT_OQ));
+    fx = _mm256_fnmadd_ps(rx, q9, fx);
+    fy = _mm256_fnmadd_ps(ry, q9, fy);
+
+    _mm256_store_ps(ioBatch.fx, fx);
+    _mm256_store_ps(ioBatch.fy, fy);
+    _mm256_store_ps(ioBatch.torque, torque);
+    _mm256_store_ps(ioBatch.otherTorque, otherTorque);
+}
+
+bool hasAvx2() {
+    static const bool sHasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return sHasAvx2;
+}
+#else
+bool hasAvx2() {
+    return false;
+}
+#endif
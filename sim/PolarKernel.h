@@ -0,0 +1,68 @@
+#pragma once
+#include "Vec2.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PARTICLELIFE_AVX2
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// One S particle against up to kWidth packed S neighbours, for the batched
+// version of calculateForceAndTorque_polar1 (solid repulsion included).
+// Inputs are relative to the particle: r = position[other] - position[p].
+// Outputs per lane: the force on p (other gets the opposite) and the torques
+// on p and on other.
+struct PolarBatch {
+    static const int kWidth = 8;
+    float orientation1 = 0.0f;
+    float v1x = 0.0f;
+    float v1y = 0.0f;
+    float w1 = 0.0f;
+    int size = 0;
+    int other[kWidth];
+    alignas(32) float rx[kWidth];
+    alignas(32) float ry[kWidth];
+    alignas(32) float rNorm[kWidth];
+    alignas(32) float orientation2[kWidth];
+    alignas(32) float v2x[kWidth];
+    alignas(32) float v2y[kWidth];
+    alignas(32) float w2[kWidth];
+    alignas(32) float fx[kWidth];
+    alignas(32) float fy[kWidth];
+    alignas(32) float torque[kWidth];
+    alignas(32) float otherTorque[kWidth];
+
+    void push(int iOther, const Vec2f& r, float iRNorm, float iOrientation2,
+              const Vec2f& iV2, float iW2) {
+        other[size] = iOther;
+        rx[size] = r.x;
+        ry[size] = r.y;
+        rNorm[size] = iRNorm;
+        orientation2[size] = iOrientation2;
+        v2x[size] = iV2.x;
+        v2y[size] = iV2.y;
+        w2[size] = iW2;
+        ++size;
+    }
+    bool full() const {
+        return size == kWidth;
+    }
+    // Unused lanes get harmless values, their outputs are ignored
+    void pad() {
+        for (int k = size; k < kWidth; ++k) {
+            rx[k] = 1.0f;
+            ry[k] = 0.0f;
+            rNorm[k] = 1.0f;
+            orientation2[k] = 0.0f;
+            v2x[k] = v2y[k] = w2[k] = 0.0f;
+        }
+    }
+};
+
+struct ModelConfig;
+
+#ifdef PARTICLELIFE_AVX2
+// Fills the outputs of every lane with the S parameters of iConfig, only call
+// it when hasAvx2()
+void calculateForceAndTorque_polar1_avx2(PolarBatch& ioBatch, const ModelConfig& iConfig);
+#endif
+// Runtime check of the AVX2 and FMA support, false when not compiled in
+bool hasAvx2();
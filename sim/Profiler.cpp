@@ -0,0 +1,146 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+Profiler g_profiler;
+const int Profiler::kHistory;
+
+static long long steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+const char* Profiler::phaseName(int iPhase) {
+    static const char* sNames[kNbPhases] = {
+        "Emit", "Compaction", "Rebuild", "React", "Clusters", "Forces", "Brownian", "Integrate",
+        "Events", "Gui", "Snapshot", "Draw", "Display"
+    };
+    return sNames[iPhase];
+}
+
+const char* Profiler::counterName(int iCounter) {
+    static const char* sNames[kNbCounters] = {
+        "Pairs visited", "Pairs in radius", "Reactions", "Cell migrations", "Neighbour builds"
+    };
+    return sNames[iCounter];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+Profiler::Profiler() : epoch(steadyNs()) {
+    for (int k = 0; k < kNbPhases; ++k) {
+        frameTimes[k] = 0;
+        for (int f = 0; f < kHistory; ++f)
+            timeHistory[k][f] = 0.0f;
+    }
+    for (int k = 0; k < kNbCounters; ++k) {
+        frameCounters[k] = 0;
+        for (int f = 0; f < kHistory; ++f)
+            counterHistory[k][f] = 0.0f;
+    }
+}
+
+long long Profiler::now() const {
+    return steadyNs() - epoch;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Profiler::record(int iPhase, long long iStart, long long iEnd) {
+    frameTimes[iPhase] += iEnd - iStart;
+    if (traceFramesLeft > 0) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceEvents.push_back(TraceEvent{iPhase, traceThread(std::this_thread::get_id()), iStart, iEnd - iStart});
+    }
+}
+
+int Profiler::traceThread(std::thread::id iThread) {
+    for (int t = 0; t < (int)traceThreads.size(); ++t)
+        if (traceThreads[t] == iThread)
+            return t;
+    traceThreads.push_back(iThread);
+    return (int)traceThreads.size()-1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Profiler::endFrame() {
+    if (!enabled)
+        return;
+    for (int k = 0; k < kNbPhases; ++k)
+        timeHistory[k][historyOffset] = frameTimes[k].exchange(0)*1e-6f;
+    for (int k = 0; k < kNbCounters; ++k)
+        counterHistory[k][historyOffset] = (float)frameCounters[k].exchange(0);
+    if (traceFramesLeft > 0) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        // Counters are shown as tracks of their own
+        TraceEvent counters{-1, 0, now(), 0};
+        traceEvents.push_back(counters);
+        if (--traceFramesLeft == 0)
+            writeTrace();
+    }
+    historyOffset = (historyOffset+1) % kHistory;
+}
+
+float Profiler::meanTime(int iPhase) const {
+    float sum = 0.0f;
+    for (int f = 0; f < kHistory; ++f)
+        sum += timeHistory[iPhase][f];
+    return sum/kHistory;
+}
+
+float Profiler::meanCount(int iCounter) const {
+    float sum = 0.0f;
+    for (int f = 0; f < kHistory; ++f)
+        sum += counterHistory[iCounter][f];
+    return sum/kHistory;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Profiler::startTrace(int iNbFrames, const std::string& iPath) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    // The counters of the trace come from the history
+    iNbFrames = std::max(1, std::min(iNbFrames, kHistory));
+    enabled = true;
+    traceEvents.clear();
+    traceThreads.clear();
+    traceThread(std::this_thread::get_id());
+    tracePath = iPath;
+    traceFramesLeft = iNbFrames;
+    traceStatus = "Recording " + std::to_string(iNbFrames) + " frames";
+}
+
+// Called with traceMutex held. The counter events carry the history entry
+// of their frame, which endFrame() has just filled.
+bool Profiler::writeTrace() {
+    std::ofstream file(tracePath);
+    if (!file) {
+        traceStatus = "Cannot write " + tracePath;
+        return false;
+    }
+    int nbFrames = 0;
+    for (const TraceEvent& event : traceEvents)
+        if (event.phase < 0)
+            ++nbFrames;
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    int frame = 0;
+    for (const TraceEvent& event : traceEvents) {
+        if (!first)
+            file << ",\n";
+        first = false;
+        if (event.phase >= 0) {
+            file << "{\"name\":\"" << phaseName(event.phase) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+                 << ",\"ts\":" << event.start*1e-3 << ",\"dur\":" << event.duration*1e-3 << "}";
+        } else {
+            int f = (historyOffset - (nbFrames-1-frame) + kHistory) % kHistory;
+            file << "{\"name\":\"Counters\",\"ph\":\"C\",\"pid\":1,\"ts\":" << event.start*1e-3 << ",\"args\":{";
+            for (int k = 0; k < kNbCounters; ++k)
+                file << (k ? "," : "") << "\"" << counterName(k) << "\":" << (long long)counterHistory[k][f];
+            file << "}}";
+            ++frame;
+        }
+    }
+    file << "\n]}\n";
+    traceEvents.clear();
+    traceStatus = "Wrote " + std::to_string(nbFrames) + " frames to " + tracePath;
+    return true;
+}
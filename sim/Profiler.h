@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Per phase timers and counters of Model::step() and of the frame loop.
+// Disabled, a ProfileScope costs a test of g_profiler.enabled and the
+// counters are not touched.
+// Times and counters add up until endFrame() which moves them to a rolling
+// history of kHistory frames. startTrace() records every scope of the next
+// frames and writes them as a Chrome trace (chrome://tracing or Perfetto).
+struct Profiler {
+    enum Phase {
+        // Model::step()
+        Emit,
+        Compaction,
+        Rebuild,
+        React,
+        Clusters, // S cluster analysis
+        Forces,
+        Brownian,
+        Integrate,
+        // Frame loop
+        Events,
+        Gui,
+        Snapshot, // Simulation thread hand-off
+        Draw,
+        Display,
+        kNbPhases
+    };
+    enum Counter {
+        PairsVisited,
+        PairsInRadius,
+        Reactions,
+        CellMigrations,
+        NeighbourBuilds, // Verlet lists
+        kNbCounters
+    };
+    static const int kHistory = 240;
+    static const char* phaseName(int iPhase);
+    static const char* counterName(int iCounter);
+
+    struct TraceEvent {
+        int phase;
+        int thread;
+        long long start; // ns since the profiler creation
+        long long duration;
+    };
+
+    std::atomic<bool> enabled{false};
+    std::atomic<long long> frameTimes[kNbPhases]; // ns
+    std::atomic<long long> frameCounters[kNbCounters];
+    float timeHistory[kNbPhases][kHistory]; // ms per frame
+    float counterHistory[kNbCounters][kHistory];
+    int historyOffset = 0; // Oldest frame of the history, overwritten next
+    long long epoch;
+
+    std::mutex traceMutex;
+    std::vector<TraceEvent> traceEvents;
+    std::vector<std::thread::id> traceThreads;
+    std::atomic<int> traceFramesLeft{0};
+    std::string tracePath;
+    std::string traceStatus;
+
+    Profiler();
+
+    long long now() const;
+    void count(Counter iCounter, long long iValue) {
+        if (enabled)
+            frameCounters[iCounter] += iValue;
+    }
+    void record(int iPhase, long long iStart, long long iEnd);
+    void endFrame();
+    // Mean over the history, in ms for phases
+    float meanTime(int iPhase) const;
+    float meanCount(int iCounter) const;
+
+    // Records the next iNbFrames frames then writes them to iPath, enables the profiler
+    void startTrace(int iNbFrames, const std::string& iPath);
+    bool tracing() const {
+        return traceFramesLeft > 0;
+    }
+
+private:
+    int traceThread(std::thread::id iThread);
+    bool writeTrace();
+};
+
+extern Profiler g_profiler;
+
+// Times the enclosing block as phase iPhase, or up to stop()
+struct ProfileScope {
+    int phase;
+    long long start;
+
+    explicit ProfileScope(int iPhase) : phase(iPhase), start(g_profiler.enabled ? g_profiler.now() : -1) {}
+    ~ProfileScope() {
+        stop();
+    }
+    void stop() {
+        if (start >= 0)
+            g_profiler.record(phase, start, g_profiler.now());
+        start = -1;
+    }
+};
@@ -0,0 +1,26 @@
+#include "RadialKernels.h"
+#include "Params.h"
+#include <cmath>
+
+//////////////////////////////////////////////////////////////////////////////
+RadialKernels::Sample RadialKernels::evaluate(float r) const {
+    Sample sample;
+    sample.distanceFactor = 1.0f / std::pow(r, expPower);
+    sample.repulsion9 = std::pow(2.0*DOT_SIZE/r, 9);
+    sample.repulsion6 = std::pow(2.0*DOT_SIZE/r, 6);
+    return sample;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void RadialKernels::update(float iRadius, float iExpPower) {
+    if (radius == iRadius && expPower == iExpPower && dotSize == DOT_SIZE)
+        return;
+    radius = iRadius;
+    expPower = iExpPower;
+    dotSize = DOT_SIZE;
+    float step = radius/(kSamples-1);
+    invStep = 1.0f/step;
+    samples.resize(kSamples);
+    for (int k = 0; k < kSamples; ++k)
+        samples[k] = evaluate(std::max(k*step, 0.5f*minRadius));
+}
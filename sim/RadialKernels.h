@@ -0,0 +1,42 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Radial factors of the interaction model tabulated over [0, interaction_radius]
+// with linear interpolation:
+// - 1/r^s_f_exp_power, S-S force
+// - (2*DOT_SIZE/r)^9, solid repulsion
+// - (2*DOT_SIZE/r)^6, S walls
+// The tables are keyed on the parameters and rebuilt lazily when a slider moves.
+struct RadialKernels {
+    static const int kSamples = 4096;
+    struct Sample {
+        float distanceFactor;
+        float repulsion9;
+        float repulsion6;
+    };
+    std::vector<Sample> samples;
+    float minRadius = 1.0f; // Closer than that the factors are too steep to interpolate
+    float radius = -1.0f;
+    float expPower = -1.0f;
+    int dotSize = -1;
+    float invStep = 0.0f;
+
+    Sample evaluate(float r) const;
+    void update(float iRadius, float iExpPower);
+    Sample lookup(float r) const {
+        if (r < minRadius)
+            return evaluate(r);
+        float x = r*invStep;
+        int k = std::min((int)x, kSamples-2);
+        float t = x-k;
+        const Sample& s0 = samples[k];
+        const Sample& s1 = samples[k+1];
+        Sample sample;
+        sample.distanceFactor = s0.distanceFactor + t*(s1.distanceFactor-s0.distanceFactor);
+        sample.repulsion9 = s0.repulsion9 + t*(s1.repulsion9-s0.repulsion9);
+        sample.repulsion6 = s0.repulsion6 + t*(s1.repulsion6-s0.repulsion6);
+        return sample;
+    }
+};
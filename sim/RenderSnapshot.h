@@ -0,0 +1,108 @@
+#pragma once
+#include "Model.h"
+#include "ParticleStore.h"
+#include "Vec2.h"
+#include <algorithm>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Occupied plug cell (i,j) of a snapshot, its particles are [first,last) and
+// count holds them per type
+struct RenderCell {
+    int i;
+    int j;
+    int first;
+    int last;
+    int count[kNbParticleTypes];
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// What the view needs of the model, copied by the simulation thread or
+// decoded from a recording
+// The simulation thread copies the particles in the order of the plug cells,
+// the view only walks the cells it shows. Recordings are not binned.
+struct RenderSnapshot {
+    std::vector<Vec2f> position;
+    std::vector<float> orientation;
+    std::vector<ParticleType> type;
+    std::vector<int> spawnStep;
+    std::vector<Emitter> emitters;
+    int step = 0;
+    float stepsPerSecond = 0.0f;
+    float stepsPerNeighbourBuild = 0.0f; // Verlet lists, 0 when they are not used
+    int gridNx = 0;
+    int gridNy = 0;
+    float candidatesPerParticle = 0.0f;
+    // Plug cells of the particles, in row then column order, empty when the
+    // particles are not binned. Cell (i,j) spans cellOrigin+(i*cellWidth, j*cellHeight)
+    // with the cell size. The cells are within cellBounds: the whole grid in
+    // the dense layout, whose border cells also hold the particles out of the
+    // world, the occupied cells in the sparse one.
+    std::vector<RenderCell> cells;
+    Vec2f cellOrigin;
+    float cellWidth = 1.0f;
+    float cellHeight = 1.0f;
+    CellRange cellBounds = {0, 0, 0, 0};
+    // Last S cluster analysis, see ClusterTracker
+    std::vector<TrackedCluster> clusters;
+    std::vector<ClusterDivision> divisions; // recent ones
+    int clusterStep = -1; // -1 before the first analysis
+    int nbClosedClusters = 0;
+    int nbDivisions = 0;
+
+    int size() const {
+        return (int)position.size();
+    }
+    // Binned when the plug holds every particle, right after a step
+    void copyFrom(const Model& iModel) {
+        const ParticleStore& particles = iModel.particles;
+        const Plug& plug = iModel.plug;
+        cells.clear();
+        if ((int)plug.cellParticles.size() == particles.size() && !plug.cellStart.empty()) {
+            int n = particles.size();
+            position.resize(n);
+            orientation.resize(n);
+            type.resize(n);
+            spawnStep.resize(n);
+            // A new cell starts wherever the cell of the slot changes
+            int k = -1;
+            for (int s = 0; s < n; ++s) {
+                int p = plug.cellParticles[s];
+                position[s] = particles.position[p];
+                orientation[s] = particles.orientation[p];
+                type[s] = particles.type[p];
+                spawnStep[s] = particles.spawnStep[p];
+                if (plug.particleCell[p] != k) {
+                    k = plug.particleCell[p];
+                    Vec2i ij = plug.k2ij(k);
+                    cells.push_back(RenderCell{ij.x, ij.y, s, plug.cellStart[k+1], {}});
+                }
+                ++cells.back().count[type[s]];
+            }
+            cellOrigin = Vec2f(-0.5f*plug.worldWidth, -0.5f*plug.worldHeight);
+            cellWidth = plug.cellWidth;
+            cellHeight = plug.cellHeight;
+            cellBounds = {0, plug.nbCellsX-1, 0, plug.nbCellsY-1};
+            if (plug.sparse && !cells.empty()) {
+                cellBounds = {cells.front().i, cells.front().i, cells.front().j, cells.back().j};
+                for (const RenderCell& cell : cells) {
+                    cellBounds.i0 = std::min(cellBounds.i0, cell.i);
+                    cellBounds.i1 = std::max(cellBounds.i1, cell.i);
+                }
+            }
+        } else {
+            position.assign(particles.position.begin(), particles.position.end());
+            orientation.assign(particles.orientation.begin(), particles.orientation.end());
+            type.assign(particles.type.begin(), particles.type.end());
+            spawnStep.assign(particles.spawnStep.begin(), particles.spawnStep.end());
+        }
+        emitters = iModel.emitters;
+        step = iModel._step;
+        const ClusterTracker& tracker = iModel.clusters;
+        clusters = tracker.clusters;
+        divisions = tracker.divisions;
+        clusterStep = tracker.step;
+        nbClosedClusters = tracker.nbClosed;
+        nbDivisions = tracker.nbDivisions;
+    }
+};
@@ -0,0 +1,184 @@
+#include "Scenario.h"
+#include <fstream>
+#include <sstream>
+
+//////////////////////////////////////////////////////////////////////////////
+static const char* sTypeNames[kNbParticleTypes] = {"F", "A", "B", "S", "L"};
+
+bool particleTypeFromString(const std::string& iName, ParticleType& oType) {
+    for (int t = 0; t < kNbParticleTypes; ++t) {
+        if (iName == sTypeNames[t]) {
+            oType = (ParticleType)t;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* particleTypeName(ParticleType iType) {
+    return sTypeNames[iType];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// <x> <y> <count>[/<period>] rect <w> <h> | disc <radius>, then <type>[:weight]...
+static bool parseEmitter(std::istream& ioWords, Emitter& oEmitter) {
+    std::string rate, shape;
+    if (!(ioWords >> oEmitter.center.x >> oEmitter.center.y >> rate >> shape))
+        return false;
+    char slash = 0;
+    std::istringstream rateWords(rate);
+    if (!(rateWords >> oEmitter.count))
+        return false;
+    if (!(rateWords >> slash >> oEmitter.period))
+        oEmitter.period = 1;
+    if ((slash && slash != '/') || oEmitter.count < 0 || oEmitter.period <= 0)
+        return false;
+    if (shape == "rect") {
+        oEmitter.shape = Emitter::Rect;
+        if (!(ioWords >> oEmitter.halfSize.x >> oEmitter.halfSize.y))
+            return false;
+        oEmitter.halfSize *= 0.5f;
+    } else if (shape == "disc") {
+        oEmitter.shape = Emitter::Disc;
+        if (!(ioWords >> oEmitter.halfSize.x))
+            return false;
+        oEmitter.halfSize.y = oEmitter.halfSize.x;
+    } else {
+        return false;
+    }
+    if (oEmitter.halfSize.x < 0.0f || oEmitter.halfSize.y < 0.0f)
+        return false;
+    std::string mix;
+    int nbTypes = 0;
+    while (ioWords >> mix) {
+        std::string::size_type colon = mix.find(':');
+        ParticleType type;
+        float weight = 1.0f;
+        if (!particleTypeFromString(mix.substr(0, colon), type))
+            return false;
+        if (colon != std::string::npos) {
+            std::istringstream weightWords(mix.substr(colon+1));
+            if (!(weightWords >> weight) || weight <= 0.0f)
+                return false;
+        }
+        oEmitter.mix[type] += weight;
+        ++nbTypes;
+    }
+    return nbTypes > 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool Scenario::load(const std::string& iPath, std::string& oError) {
+    std::ifstream file(iPath);
+    if (!file) {
+        oError = "cannot open " + iPath;
+        return false;
+    }
+    name = iPath;
+    if (!parse(file, oError)) {
+        oError = iPath + ":" + oError;
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool Scenario::parse(std::istream& iStream, std::string& oError) {
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(iStream, line)) {
+        ++lineNumber;
+        std::string::size_type comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command))
+            continue;
+        bool ok = false;
+        if (command == "set") {
+            std::string paramName, value;
+            Setting setting;
+            alignas(8) char scratch[8];
+            if (words >> paramName >> value) {
+                setting.param = findParam(paramName);
+                setting.value = value;
+                ok = setting.param && setting.param->parse(value, scratch);
+            }
+            if (ok)
+                settings.push_back(setting);
+        } else if (command == "world") {
+            ok = (words >> worldWidth >> worldHeight) && worldWidth > 0 && worldHeight > 0;
+            if (ok && (words >> gridNx))
+                ok = (words >> gridNy) && gridNx > 0 && gridNy > 0;
+        } else if (command == "spawn" || command == "fill") {
+            std::string typeName;
+            Spawn spawn;
+            spawn.uniform = command == "fill";
+            ok = (words >> typeName >> spawn.count) && particleTypeFromString(typeName, spawn.type) && spawn.count >= 0;
+            if (ok && (spawn.uniform || !(words >> spawn.origin.x >> spawn.origin.y)))
+                spawn.origin = Vec2f(0, 0);
+            if (ok)
+                spawns.push_back(spawn);
+        } else if (command == "source") {
+            std::string typeName;
+            Source source;
+            ok = (words >> typeName >> source.origin.x >> source.origin.y) && particleTypeFromString(typeName, source.type);
+            if (ok && !(words >> source.period))
+                source.period = 1;
+            ok = ok && source.period > 0;
+            if (ok)
+                sources.push_back(source);
+        } else if (command == "emitter") {
+            Emitter emitter;
+            ok = parseEmitter(words, emitter);
+            if (ok)
+                emitters.push_back(emitter);
+        } else if (command == "steps") {
+            ok = (words >> steps) && steps >= 0;
+        }
+        if (!ok) {
+            oError = std::to_string(lineNumber) + ": invalid line '" + line + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void Scenario::applySettings(Model& ioModel) const {
+    ModelConfig& config = ioModel.config;
+    if (worldWidth > 0) {
+        config.world_width = worldWidth;
+        config.world_height = worldHeight;
+    }
+    if (gridNx > 0)
+        config.auto_grid = false;
+    for (const Setting& setting : settings)
+        setting.param->fromString(config, setting.value);
+    ioModel.plug.configure(config);
+    if (gridNx > 0)
+        ioModel.plug.setResolution(gridNx, gridNy);
+}
+
+void Scenario::apply(Model& ioModel) const {
+    applySettings(ioModel);
+    ioModel.init();
+    const ModelConfig& config = ioModel.config;
+    Vec2f world(config.world_width/2.0f, config.world_height/2.0f);
+    Vec2f spread(config.world_width/20.0f, config.world_height/20.0f);
+    for (const Spawn& spawn : spawns) {
+        Emitter emitter = Emitter::ofType(spawn.type, spawn.origin, spawn.uniform ? world : spread);
+        ioModel.emit(emitter, spawn.count, ioModel._step);
+    }
+    ioModel.emitters = getEmitters(config);
+}
+
+std::vector<Emitter> Scenario::getEmitters(const ModelConfig& iConfig) const {
+    Vec2f spread(iConfig.world_width/20.0f, iConfig.world_height/20.0f);
+    std::vector<Emitter> result;
+    for (const Source& source : sources)
+        result.push_back(Emitter::ofType(source.type, source.origin, spread, 1, source.period));
+    result.insert(result.end(), emitters.begin(), emitters.end());
+    return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "Emitter.h"
+#include "Model.h"
+#include "Params.h"
+#include "ParticleStore.h"
+#include "Vec2.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Scripted initial state of a run, one command per line, # starts a comment:
+//   set <param> <value>             see getParams() for the names
+//   world <width> <height> [nx ny]  world size, and fixed grid cells when given
+//   spawn <type> <count> [x y]      type is one of F A B S L, spread as Model::spawn
+//   fill <type> <count>             uniformly over the whole world
+//   source <type> <x> <y> [period]  one particle every period steps (default 1),
+//                                   spread as Model::spawn
+//   emitter <x> <y> <rate> rect <w> <h> <mix>
+//   emitter <x> <y> <rate> disc <radius> <mix>
+//                                   rate is <count>[/<period>] particles per step,
+//                                   mix is one or more <type>[:weight]
+//   steps <n>                       default length of the run
+struct Scenario {
+    struct Setting {
+        Param* param;
+        std::string value;
+    };
+    struct Spawn {
+        ParticleType type;
+        int count;
+        Vec2f origin;
+        bool uniform;
+    };
+    struct Source {
+        ParticleType type;
+        Vec2f origin;
+        int period;
+    };
+    std::string name;
+    int worldWidth = 0; // 0 keeps the current world
+    int worldHeight = 0;
+    int gridNx = 0; // 0 keeps the current grid
+    int gridNy = 0;
+    std::vector<Setting> settings;
+    std::vector<Spawn> spawns;
+    std::vector<Source> sources;
+    std::vector<Emitter> emitters;
+    int steps = 1000;
+
+    // False with a message naming the faulty line when the file is invalid
+    bool load(const std::string& iPath, std::string& oError);
+    bool parse(std::istream& iStream, std::string& oError);
+    // Sets the world, the grid and the parameters of the model
+    void applySettings(Model& ioModel) const;
+    // applySettings() then resets the model to the initial population and emitters
+    void apply(Model& ioModel) const;
+    // The sources and the emitters of the scenario, for the world of iConfig
+    std::vector<Emitter> getEmitters(const ModelConfig& iConfig) const;
+};
+
+bool particleTypeFromString(const std::string& iName, ParticleType& oType);
+const char* particleTypeName(ParticleType iType);
@@ -0,0 +1,159 @@
+#include "SimulationThread.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+
+//////////////////////////////////////////////////////////////////////////////
+void SimulationThread::start() {
+    if (running)
+        return;
+    running = true;
+    thread = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::stop() {
+    if (!running)
+        return;
+    running = false;
+    thread.join();
+}
+
+void SimulationThread::push(const Command& iCommand) {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.push_back(iCommand);
+}
+
+void SimulationThread::runCommands() {
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        runningCommands.swap(commands);
+    }
+    for (const Command& command : runningCommands)
+        command(*this);
+    runningCommands.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void SimulationThread::saveCheckpoint(const std::string& iPath) {
+    push([iPath](SimulationThread& ioSimulation) {
+        std::string error;
+        bool ok = ::saveCheckpoint(iPath, ioSimulation.model, error);
+        std::lock_guard<std::mutex> lock(ioSimulation.statusMutex);
+        ioSimulation.status = ok ? "Saved step " + std::to_string(ioSimulation.model._step) + " to " + iPath : error;
+    });
+}
+
+void SimulationThread::loadCheckpoint(const std::string& iPath) {
+    push([iPath](SimulationThread& ioSimulation) {
+        std::string error;
+        bool ok = ::loadCheckpoint(iPath, ioSimulation.model, error);
+        std::lock_guard<std::mutex> lock(ioSimulation.statusMutex);
+        if (!ok) {
+            ioSimulation.status = error;
+            return;
+        }
+        ioSimulation.status = "Loaded step " + std::to_string(ioSimulation.model._step) + " from " + iPath;
+        LoadedState& state = ioSimulation.loadedState;
+        state.params.clear();
+        for (const Param& param : getParams())
+            state.params.push_back(param.get(ioSimulation.model.config));
+        state.worldWidth = ioSimulation.model.config.world_width;
+        state.worldHeight = ioSimulation.model.config.world_height;
+        ioSimulation.loaded = true;
+    });
+}
+
+void SimulationThread::startRecording(const std::string& iPath, int iInterval) {
+    push([iPath, iInterval](SimulationThread& ioSimulation) {
+        std::string error;
+        // A hundredth of a dot is well below what the view can show
+        bool ok = ioSimulation.recorder.start(iPath, ioSimulation.model, iInterval, DOT_SIZE/100.0f, error);
+        std::lock_guard<std::mutex> lock(ioSimulation.statusMutex);
+        ioSimulation.status = ok ? "Recording to " + iPath : error;
+    });
+}
+
+void SimulationThread::stopRecording() {
+    push([](SimulationThread& ioSimulation) {
+        ioSimulation.recorder.stop();
+        std::lock_guard<std::mutex> lock(ioSimulation.statusMutex);
+        ioSimulation.status = "Recorded " + std::to_string(ioSimulation.recorder.nbFrames) + " frames";
+    });
+}
+
+std::string SimulationThread::checkpointStatus() {
+    std::lock_guard<std::mutex> lock(statusMutex);
+    return status;
+}
+
+bool SimulationThread::takeLoadedState(LoadedState& oState) {
+    std::lock_guard<std::mutex> lock(statusMutex);
+    if (!loaded)
+        return false;
+    oState = loadedState;
+    loaded = false;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// A snapshot is published at most every kSnapshotInterval, enough for any
+// display rate without copying the state after every step
+void SimulationThread::loop() {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration kSnapshotInterval = std::chrono::milliseconds(4);
+    const Clock::duration kRateWindow = std::chrono::milliseconds(500);
+    Clock::time_point nextStep = Clock::now();
+    Clock::time_point lastSnapshot = Clock::now() - kSnapshotInterval;
+    Clock::time_point rateStart = Clock::now();
+    int rateSteps = 0;
+    long long rateBuilds = 0;
+    float stepsPerSecond = 0.0f;
+    float stepsPerNeighbourBuild = 0.0f;
+    float candidatesPerParticle = 0.0f;
+    while (running) {
+        runCommands();
+        if (paused) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            nextStep = Clock::now();
+            continue;
+        }
+        model.step();
+        recorder.record(model);
+        ++rateSteps;
+
+        Clock::time_point now = Clock::now();
+        if (now - rateStart >= kRateWindow) {
+            stepsPerSecond = rateSteps / std::chrono::duration<float>(now - rateStart).count();
+            long long nbBuilds = model.verletLists.nbBuilds - rateBuilds;
+            stepsPerNeighbourBuild = model.config.verlet_lists ? (float)rateSteps/std::max(1LL, nbBuilds) : 0.0f;
+            rateBuilds = model.verletLists.nbBuilds;
+            candidatesPerParticle = model.plug.averageCandidates();
+            rateStart = now;
+            rateSteps = 0;
+        }
+        if (now - lastSnapshot >= kSnapshotInterval) {
+            ProfileScope scope(Profiler::Snapshot);
+            RenderSnapshot& snapshot = snapshots.writeBuffer();
+            snapshot.copyFrom(model);
+            snapshot.stepsPerSecond = stepsPerSecond;
+            snapshot.stepsPerNeighbourBuild = stepsPerNeighbourBuild;
+            snapshot.gridNx = model.plug.nbCellsX;
+            snapshot.gridNy = model.plug.nbCellsY;
+            snapshot.candidatesPerParticle = candidatesPerParticle;
+            snapshots.publish();
+            lastSnapshot = now;
+        }
+
+        // Step rate limit, a late thread does not try to catch up
+        int limit = maxStepsPerSecond;
+        if (limit > 0) {
+            nextStep += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0/limit));
+            if (nextStep > now)
+                std::this_thread::sleep_until(nextStep);
+            else
+                nextStep = now;
+        } else {
+            nextStep = now;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "Checkpoint.h"
+#include "Model.h"
+#include "Params.h"
+#include "RenderSnapshot.h"
+#include "Trajectory.h"
+#include "TripleBuffer.h"
+#include "Vec2.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs the model on its own thread, as fast as allowed by maxStepsPerSecond.
+// Once started the model and its config belong to the thread:
+// other threads send commands, applied between two steps in order, and read
+// the latest RenderSnapshot.
+struct SimulationThread {
+    typedef std::function<void(SimulationThread&)> Command;
+
+    Model model;
+    TripleBuffer<RenderSnapshot> snapshots;
+    std::atomic<int> maxStepsPerSecond{600}; // 0 for no limit
+    std::atomic<bool> paused{false}; // commands still run
+    TrajectoryRecorder recorder;
+
+    std::mutex commandMutex;
+    std::vector<Command> commands;
+    std::vector<Command> runningCommands;
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    // State changed by a checkpoint load that the GUI keeps a copy of
+    struct LoadedState {
+        std::vector<ParamValue> params; // in getParams() order
+        int worldWidth;
+        int worldHeight;
+    };
+
+    ~SimulationThread() {
+        stop();
+    }
+
+    void start();
+    void stop();
+    void push(const Command& iCommand);
+    // Latest snapshot, reader side of the triple buffer: a single thread only
+    const RenderSnapshot& snapshot() {
+        return snapshots.read();
+    }
+
+    // Checkpoints are saved and loaded by the thread between two steps
+    void saveCheckpoint(const std::string& iPath);
+    void loadCheckpoint(const std::string& iPath);
+    // Recording of a frame every iInterval steps, see TrajectoryRecorder
+    void startRecording(const std::string& iPath, int iInterval);
+    void stopRecording();
+    // Outcome of the last checkpoint or recording command
+    std::string checkpointStatus();
+    // True once after each successful load, with the new values
+    bool takeLoadedState(LoadedState& oState);
+
+private:
+    void loop();
+    void runCommands();
+
+    std::mutex statusMutex;
+    std::string status;
+    bool loaded = false;
+    LoadedState loadedState;
+};
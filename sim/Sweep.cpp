@@ -0,0 +1,281 @@
+#include "Sweep.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+//////////////////////////////////////////////////////////////////////////////
+bool Sweep::load(const std::string& iPath, std::string& oError) {
+    std::ifstream file(iPath);
+    if (!file) {
+        oError = "cannot open " + iPath;
+        return false;
+    }
+    name = iPath;
+    std::string::size_type slash = iPath.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : iPath.substr(0, slash+1);
+    if (!parse(file, directory, oError)) {
+        oError = iPath + ":" + oError;
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool Sweep::parse(std::istream& iStream, const std::string& iDirectory, std::string& oError) {
+    std::string line;
+    int lineNumber = 0;
+    bool hasScenario = false;
+    while (std::getline(iStream, line)) {
+        ++lineNumber;
+        std::string::size_type comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command))
+            continue;
+        bool ok = false;
+        if (command == "scenario") {
+            std::string path, error;
+            if (words >> path) {
+                if (path[0] != '/' && path[0] != '\\' && path.find(':') == std::string::npos)
+                    path = iDirectory + path;
+                scenario = Scenario();
+                if (!scenario.load(path, error)) {
+                    oError = std::to_string(lineNumber) + ": " + error;
+                    return false;
+                }
+                ok = hasScenario = true;
+            }
+        } else if (command == "set") {
+            std::string paramName, value;
+            Scenario::Setting setting;
+            alignas(8) char scratch[8];
+            if (words >> paramName >> value) {
+                setting.param = findParam(paramName);
+                setting.value = value;
+                ok = setting.param && setting.param->parse(value, scratch);
+            }
+            if (ok)
+                settings.push_back(setting);
+        } else if (command == "vary") {
+            std::string paramName;
+            Range range;
+            if (words >> paramName >> range.min >> range.max) {
+                if (!(words >> range.count))
+                    range.count = 2;
+                range.param = findParam(paramName);
+                ok = range.param && range.count > 0;
+            }
+            if (ok)
+                ranges.push_back(range);
+        } else if (command == "sample") {
+            std::string mode;
+            if (words >> mode) {
+                latinHypercube = mode == "lhs";
+                ok = mode == "grid" || ((words >> nbSamples) && nbSamples > 0);
+            }
+        } else if (command == "repeats") {
+            ok = (words >> repeats) && repeats > 0;
+        } else if (command == "steps") {
+            ok = (words >> steps) && steps >= 0;
+        } else if (command == "seed") {
+            ok = (bool)(words >> seed);
+        }
+        if (!ok) {
+            oError = std::to_string(lineNumber) + ": invalid line '" + line + "'";
+            return false;
+        }
+    }
+    if (!hasScenario) {
+        oError = " no scenario line";
+        return false;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int Sweep::sampleCount() const {
+    if (latinHypercube)
+        return nbSamples;
+    int count = 1;
+    for (const Range& range : ranges)
+        count *= range.count;
+    return count;
+}
+
+// Setting string of iValue, ints and bools rounded
+static std::string formatValue(const Param& iParam, float iValue) {
+    std::ostringstream text;
+    switch (iParam.kind) {
+    case Param::Int: text << std::lround(iValue); break;
+    case Param::Float: text << std::setprecision(9) << iValue; break;
+    case Param::Bool: text << (iValue >= 0.5f ? 1 : 0); break;
+    }
+    return text.str();
+}
+
+// The grid varies the last range fastest. The Latin hypercube splits every
+// range in as many strata as samples and gives each stratum to one sample,
+// at a random place within it. Only the raw outputs of the generator are
+// used, the samples of a seed are the same with any standard library.
+std::vector<std::vector<std::string>> Sweep::getSamples() const {
+    int nbSamples = sampleCount();
+    int nbRanges = (int)ranges.size();
+    std::vector<std::vector<std::string>> samples(nbSamples, std::vector<std::string>(nbRanges));
+    if (!latinHypercube) {
+        for (int s = 0; s < nbSamples; ++s) {
+            int index = s;
+            for (int d = nbRanges-1; d >= 0; --d) {
+                const Range& range = ranges[d];
+                int k = index % range.count;
+                index /= range.count;
+                float t = range.count > 1 ? (float)k/(range.count-1) : 0.0f;
+                samples[s][d] = formatValue(*range.param, range.min + t*(range.max-range.min));
+            }
+        }
+        return samples;
+    }
+    std::mt19937 gen(seed);
+    auto uniform = [&gen]() {
+        return (gen() >> 8)*(1.0f/16777216.0f);
+    };
+    std::vector<int> strata(nbSamples);
+    for (int d = 0; d < nbRanges; ++d) {
+        const Range& range = ranges[d];
+        std::iota(strata.begin(), strata.end(), 0);
+        for (int s = nbSamples-1; s > 0; --s)
+            std::swap(strata[s], strata[gen() % (s+1)]);
+        for (int s = 0; s < nbSamples; ++s) {
+            float t = (strata[s] + uniform())/nbSamples;
+            samples[s][d] = formatValue(*range.param, range.min + t*(range.max-range.min));
+        }
+    }
+    return samples;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+Scenario Sweep::getRunScenario(int iRun, const std::vector<std::vector<std::string>>& iSamples) const {
+    Scenario run = scenario;
+    run.settings.insert(run.settings.end(), settings.begin(), settings.end());
+    const std::vector<std::string>& values = iSamples[iRun/repeats];
+    for (int d = 0; d < (int)ranges.size(); ++d)
+        run.settings.push_back(Scenario::Setting{ranges[d].param, values[d]});
+    if (repeats > 1) {
+        ModelConfig config;
+        for (const Scenario::Setting& setting : run.settings)
+            setting.param->fromString(config, setting.value);
+        run.settings.push_back(Scenario::Setting{findParam("seed"), std::to_string(config.seed + iRun%repeats)});
+    }
+    if (steps >= 0)
+        run.steps = steps;
+    return run;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+SweepResult runSweepCase(const Sweep& iSweep, int iRun, const std::vector<std::vector<std::string>>& iSamples) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Scenario scenario = iSweep.getRunScenario(iRun, iSamples);
+    ModelConfig config;
+    config.nb_threads = 1;
+    Model model(config);
+    scenario.apply(model);
+    for (int i = 0; i < scenario.steps; ++i)
+        model.step();
+
+    SweepResult result;
+    result.run = iRun;
+    result.values = iSamples[iRun/iSweep.repeats];
+    result.seed = model.config.seed;
+    result.steps = model._step;
+    result.population = model.particles.size();
+    for (ParticleType type : model.particles.type)
+        ++result.typeCounts[type];
+    std::copy(std::begin(model.reactionCounts), std::end(model.reactionCounts), result.reactionCounts);
+    model.analyseClusters();
+    for (const TrackedCluster& cluster : model.clusters.clusters)
+        result.clusterSizes.push_back(cluster.size);
+    result.nbClosed = model.clusters.nbClosed;
+    result.nbDivisions = model.clusters.nbDivisions;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Pairs of reactant types a <= b that react, index a*kNbParticleTypes+b
+static std::vector<int> getReactingPairs() {
+    std::vector<int> pairs;
+    for (int a = 0; a < kNbParticleTypes; ++a)
+        for (int b = a; b < kNbParticleTypes; ++b)
+            if (getPairInteraction((ParticleType)a, (ParticleType)b).reacts)
+                pairs.push_back(a*kNbParticleTypes+b);
+    return pairs;
+}
+
+static std::string getCsvHeader(const Sweep& iSweep) {
+    std::ostringstream line;
+    line << "run";
+    for (const Sweep::Range& range : iSweep.ranges)
+        line << "," << range.param->name;
+    line << ",seed,steps,particles";
+    for (int t = 0; t < kNbParticleTypes; ++t)
+        line << "," << particleTypeName((ParticleType)t);
+    for (int pair : getReactingPairs())
+        line << "," << particleTypeName((ParticleType)(pair/kNbParticleTypes))
+             << "+" << particleTypeName((ParticleType)(pair%kNbParticleTypes));
+    line << ",clusters,largest_cluster,clustered_S,closed_rings,divisions,seconds\n";
+    return line.str();
+}
+
+static std::string getCsvLine(const SweepResult& iResult) {
+    std::ostringstream line;
+    line << iResult.run;
+    for (const std::string& value : iResult.values)
+        line << "," << value;
+    line << "," << iResult.seed << "," << iResult.steps << "," << iResult.population;
+    for (int count : iResult.typeCounts)
+        line << "," << count;
+    for (int pair : getReactingPairs())
+        line << "," << iResult.reactionCounts[pair];
+    int largest = iResult.clusterSizes.empty() ? 0 : iResult.clusterSizes.front();
+    int clustered = std::accumulate(iResult.clusterSizes.begin(), iResult.clusterSizes.end(), 0);
+    line << "," << iResult.clusterSizes.size() << "," << largest << "," << clustered
+         << "," << iResult.nbClosed << "," << iResult.nbDivisions << "," << iResult.seconds << "\n";
+    return line.str();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// The runs are the tasks of a pool: claimed one by one, a long run does not
+// hold the others back. A Model is built per run and stepped on its own pool.
+void runSweep(const Sweep& iSweep, int iNbWorkers, std::ostream& oCsv,
+              const std::function<void(const SweepResult&)>& iOnRun) {
+    std::vector<std::vector<std::string>> samples = iSweep.getSamples();
+    int nbRuns = iSweep.runCount();
+    oCsv << getCsvHeader(iSweep) << std::flush;
+
+    std::mutex mutex;
+    std::vector<std::string> lines(nbRuns);
+    std::vector<char> done(nbRuns, 0);
+    int nextLine = 0;
+    ThreadPool workers(std::max(1, iNbWorkers));
+    workers.parallelFor(nbRuns, [&](int r) {
+        SweepResult result = runSweepCase(iSweep, r, samples);
+        std::lock_guard<std::mutex> lock(mutex);
+        lines[r] = getCsvLine(result);
+        done[r] = 1;
+        for (; nextLine < nbRuns && done[nextLine]; ++nextLine) {
+            oCsv << lines[nextLine];
+            lines[nextLine].clear();
+        }
+        oCsv.flush();
+        if (iOnRun)
+            iOnRun(result);
+    });
+}
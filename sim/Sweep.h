@@ -0,0 +1,80 @@
+#pragma once
+#include "Model.h"
+#include "Params.h"
+#include "Scenario.h"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs of a scenario over ranges of parameters, one command per line, # starts
+// a comment:
+//   scenario <path>                  relative to the sweep file
+//   set <param> <value>              for every run, after the scenario settings
+//   vary <param> <min> <max> [n]     range of a parameter, n grid values (default 2)
+//   sample grid                      every combination of the grid values (default)
+//   sample lhs <samples>             Latin hypercube samples of the ranges
+//   repeats <n>                      runs per sample, with seeds seed, seed+1...
+//   steps <n>                        length of the runs, default the scenario's
+//   seed <n>                         of the Latin hypercube
+// Every run is a Model of its own with one thread unless nb_threads is set,
+// the runs are spread over the workers. The S clusters of the results are
+// analysed at the last step with the cluster_ params, divisions are only
+// followed during the runs when cluster_interval is set.
+struct Sweep {
+    struct Range {
+        Param* param;
+        float min;
+        float max;
+        int count; // Grid values
+    };
+    std::string name;
+    Scenario scenario;
+    std::vector<Scenario::Setting> settings;
+    std::vector<Range> ranges;
+    bool latinHypercube = false;
+    int nbSamples = 1; // Latin hypercube
+    int repeats = 1;
+    int steps = -1; // -1 for the scenario's
+    uint32_t seed = 1;
+
+    // False with a message naming the faulty line when the file is invalid
+    bool load(const std::string& iPath, std::string& oError);
+    bool parse(std::istream& iStream, const std::string& iDirectory, std::string& oError);
+    // Values of the ranges for every sample, as setting strings
+    std::vector<std::vector<std::string>> getSamples() const;
+    int sampleCount() const;
+    int runCount() const {
+        return sampleCount()*repeats;
+    }
+    // The scenario of run iRun of iSamples: the sweep settings then the values
+    // of its sample, and its seed when there are repeats
+    Scenario getRunScenario(int iRun, const std::vector<std::vector<std::string>>& iSamples) const;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Summary of a run, at its last step
+struct SweepResult {
+    int run = 0;
+    std::vector<std::string> values; // of the ranges
+    int seed = 0;
+    int steps = 0;
+    int population = 0;
+    int typeCounts[kNbParticleTypes] = {};
+    long long reactionCounts[kNbParticleTypes*kNbParticleTypes] = {}; // as Model::reactionCounts
+    std::vector<int> clusterSizes; // S groups, decreasing
+    int nbClosed = 0; // S groups that are closed rings
+    int nbDivisions = 0;
+    double seconds = 0.0;
+};
+
+SweepResult runSweepCase(const Sweep& iSweep, int iRun, const std::vector<std::vector<std::string>>& iSamples);
+
+// Runs of iSweep on iNbWorkers threads, one CSV line per run in run order,
+// each written as soon as the runs before it are done. iOnRun is called after
+// every run, one call at a time.
+void runSweep(const Sweep& iSweep, int iNbWorkers, std::ostream& oCsv,
+              const std::function<void(const SweepResult&)>& iOnRun);
@@ -0,0 +1,62 @@
+#include "ThreadPool.h"
+
+//////////////////////////////////////////////////////////////////////////////
+void ThreadPool::setThreadCount(int iNbThreads) {
+    stop();
+    stopping = false;
+    for (int i = 1; i < iNbThreads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, generation);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ThreadPool::parallelFor(int iNbTasks, const std::function<void(int)>& iTask) {
+    if (workers.empty() || iNbTasks <= 1) {
+        for (int t = 0; t < iNbTasks; ++t)
+            iTask(t);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &iTask;
+        jobSize = iNbTasks;
+        nextTask = 0;
+        pendingWorkers = (int)workers.size();
+        ++generation;
+    }
+    wakeCondition.notify_all();
+    runTasks(iTask, iNbTasks);
+    // Every worker has to check in, the job must outlive all of them
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]{ return pendingWorkers == 0; });
+    job = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ThreadPool::workerLoop(unsigned seenGeneration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeCondition.wait(lock, [&]{ return stopping || generation != seenGeneration; });
+        if (stopping)
+            return;
+        seenGeneration = generation;
+        const std::function<void(int)>& task = *job;
+        int nbTasks = jobSize;
+        lock.unlock();
+        runTasks(task, nbTasks);
+        lock.lock();
+        if (--pendingWorkers == 0)
+            doneCondition.notify_one();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+}
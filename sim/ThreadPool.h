@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////////
+// Persistent worker pool, the calling thread takes part in the work.
+// parallelFor(n, task) runs task(0) to task(n-1), tasks are claimed one by one
+// so uneven tasks (crowded grid tiles) balance themselves.
+struct ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    const std::function<void(int)>* job = nullptr;
+    int jobSize = 0;
+    std::atomic<int> nextTask{0};
+    int pendingWorkers = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+
+    explicit ThreadPool(int iNbThreads = 1) {
+        setThreadCount(iNbThreads);
+    }
+    ~ThreadPool() {
+        stop();
+    }
+
+    int threadCount() const {
+        return (int)workers.size()+1;
+    }
+    void setThreadCount(int iNbThreads);
+    void parallelFor(int iNbTasks, const std::function<void(int)>& iTask);
+
+private:
+    void runTasks(const std::function<void(int)>& iTask, int iNbTasks) {
+        for (int t = nextTask++; t < iNbTasks; t = nextTask++)
+            iTask(t);
+    }
+    void workerLoop(unsigned seenGeneration);
+    void stop();
+};
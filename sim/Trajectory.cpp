@@ -0,0 +1,281 @@
+#include "Trajectory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <zlib.h>
+
+static const char kMagic[8] = {'P', 'L', 'I', 'F', 'E', 'T', 'R', 'J'};
+static const uint32_t kVersion = 1;
+static const float kOrientationUnits = 65536.0f;
+
+//////////////////////////////////////////////////////////////////////////////
+// Delta coding, modulo 2^32 so that it is lossless whatever the values
+static void appendVarint(std::vector<uint8_t>& ioBytes, uint32_t iValue) {
+    while (iValue >= 0x80) {
+        ioBytes.push_back((uint8_t)(iValue | 0x80));
+        iValue >>= 7;
+    }
+    ioBytes.push_back((uint8_t)iValue);
+}
+
+static bool readVarint(const uint8_t*& ioData, const uint8_t* iEnd, uint32_t& oValue) {
+    oValue = 0;
+    for (int shift = 0; shift < 35 && ioData < iEnd; shift += 7) {
+        uint8_t byte = *ioData++;
+        oValue |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Values of index i are coded against the previous frame value of index i,
+// or 0 for the particles beyond the previous frame
+static void encodePlane(std::vector<uint8_t>& ioBytes, const std::vector<int32_t>& iValues,
+                        const std::vector<int32_t>& iPrevious) {
+    for (int i = 0; i < (int)iValues.size(); ++i) {
+        uint32_t base = i < (int)iPrevious.size() ? (uint32_t)iPrevious[i] : 0;
+        uint32_t delta = (uint32_t)iValues[i] - base;
+        appendVarint(ioBytes, (delta << 1) ^ (uint32_t)((int32_t)delta >> 31));
+    }
+}
+
+// ioValues holds the previous frame values and receives the new ones
+static bool decodePlane(const uint8_t*& ioData, const uint8_t* iEnd, int n, bool iKeyframe,
+                        std::vector<int32_t>& ioValues) {
+    if (iKeyframe)
+        ioValues.assign(n, 0);
+    else
+        ioValues.resize(n, 0);
+    for (int i = 0; i < n; ++i) {
+        uint32_t zigzag;
+        if (!readVarint(ioData, iEnd, zigzag))
+            return false;
+        uint32_t delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        ioValues[i] = (int32_t)((uint32_t)ioValues[i] + delta);
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool TrajectoryRecorder::start(const std::string& iPath, const Model& iModel, int iInterval, float iQuantum,
+                               std::string& oError) {
+    stop();
+    file.open(iPath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        oError = "cannot write " + iPath;
+        return false;
+    }
+    interval = std::max(1, iInterval);
+    quantum = iQuantum;
+    TrajectoryHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.worldWidth = iModel.config.world_width;
+    header.worldHeight = iModel.config.world_height;
+    header.interval = interval;
+    header.quantum = quantum;
+    header.keyframeInterval = kKeyframeInterval;
+    file.write((const char*)&header, sizeof(header));
+
+    nbFrames = 0;
+    nbDropped = 0;
+    nbBytes = sizeof(header);
+    previous = TrajectoryFrame();
+    frameIndex = 0;
+    stopping = false;
+    active = true;
+    writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+    return true;
+}
+
+void TrajectoryRecorder::stop() {
+    if (!active)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pendingChanged.notify_one();
+    writer.join();
+    file.close();
+    active = false;
+}
+
+void TrajectoryRecorder::record(const Model& iModel) {
+    if (!active || iModel._step % interval != 0)
+        return;
+    TrajectoryFrame frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((int)pending.size() >= kMaxPending) {
+            ++nbDropped;
+            return;
+        }
+        if (!freeFrames.empty()) {
+            frame = std::move(freeFrames.back());
+            freeFrames.pop_back();
+        }
+    }
+    const ParticleStore& particles = iModel.particles;
+    int n = particles.size();
+    frame.step = iModel._step;
+    frame.x.resize(n);
+    frame.y.resize(n);
+    frame.orientation.resize(n);
+    frame.spawnStep.assign(particles.spawnStep.begin(), particles.spawnStep.end());
+    frame.type.assign(particles.type.begin(), particles.type.end());
+    float scale = 1.0f/quantum;
+    float orientationScale = kOrientationUnits/(2.0f*M_PI);
+    for (int i = 0; i < n; ++i) {
+        frame.x[i] = (int32_t)std::lround(particles.position[i].x*scale);
+        frame.y[i] = (int32_t)std::lround(particles.position[i].y*scale);
+        frame.orientation[i] = (int32_t)(std::lround(particles.orientation[i]*orientationScale) & 0xffff);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(frame));
+    }
+    pendingChanged.notify_one();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// I/O thread
+void TrajectoryRecorder::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        pendingChanged.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty())
+            return;
+        TrajectoryFrame frame = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+        writeFrame(frame);
+        lock.lock();
+        freeFrames.push_back(std::move(frame));
+    }
+}
+
+// Leaves the frame coded before this one in ioFrame
+void TrajectoryRecorder::writeFrame(TrajectoryFrame& ioFrame) {
+    bool keyframe = frameIndex % kKeyframeInterval == 0;
+    static const TrajectoryFrame kZeros;
+    const TrajectoryFrame& base = keyframe ? kZeros : previous;
+    raw.clear();
+    encodePlane(raw, ioFrame.x, base.x);
+    encodePlane(raw, ioFrame.y, base.y);
+    encodePlane(raw, ioFrame.orientation, base.orientation);
+    encodePlane(raw, ioFrame.spawnStep, base.spawnStep);
+    raw.insert(raw.end(), ioFrame.type.begin(), ioFrame.type.end());
+
+    uLongf compressedSize = compressBound(raw.size());
+    compressed.resize(compressedSize);
+    compress2(compressed.data(), &compressedSize, raw.data(), raw.size(), Z_BEST_SPEED);
+
+    TrajectoryFrameHeader header;
+    header.compressedSize = (uint32_t)compressedSize;
+    header.rawSize = (uint32_t)raw.size();
+    header.step = ioFrame.step;
+    header.nbParticles = ioFrame.size();
+    header.keyframe = keyframe;
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)compressed.data(), compressedSize);
+
+    std::swap(previous, ioFrame);
+    ++frameIndex;
+    ++nbFrames;
+    nbBytes += sizeof(header) + compressedSize;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool TrajectoryReader::open(const std::string& iPath, std::string& oError) {
+    close();
+    if (!file.open(iPath)) {
+        oError = "cannot open " + iPath;
+        return false;
+    }
+    if (file.size < sizeof(header) || std::memcmp(file.data, kMagic, sizeof(kMagic)) != 0) {
+        oError = iPath + " is not a recording";
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (header.version != kVersion || header.quantum <= 0.0f) {
+        oError = iPath + ": unsupported recording version " + std::to_string(header.version);
+        close();
+        return false;
+    }
+    size_t offset = sizeof(header);
+    while (file.size - offset >= sizeof(TrajectoryFrameHeader)) {
+        TrajectoryFrameHeader frameHeader;
+        std::memcpy(&frameHeader, file.data + offset, sizeof(frameHeader));
+        size_t end = offset + sizeof(frameHeader) + frameHeader.compressedSize;
+        if (end > file.size)
+            break;
+        // The first frame is always a keyframe
+        frames.push_back(FrameIndex{offset, frameHeader.step, frameHeader.keyframe != 0 || frames.empty()});
+        offset = end;
+    }
+    return true;
+}
+
+void TrajectoryReader::close() {
+    file.close();
+    frames.clear();
+    currentFrame = -1;
+}
+
+bool TrajectoryReader::decode(int iFrame) {
+    if (iFrame == currentFrame)
+        return true;
+    int start = iFrame;
+    while (!frames[start].keyframe)
+        --start;
+    if (currentFrame >= start && currentFrame < iFrame)
+        start = currentFrame+1;
+    for (int f = start; f <= iFrame; ++f) {
+        currentFrame = -1;
+        TrajectoryFrameHeader frameHeader;
+        std::memcpy(&frameHeader, file.data + frames[f].offset, sizeof(frameHeader));
+        raw.resize(frameHeader.rawSize);
+        uLongf rawSize = frameHeader.rawSize;
+        const Bytef* compressed = (const Bytef*)file.data + frames[f].offset + sizeof(frameHeader);
+        if (uncompress(raw.data(), &rawSize, compressed, frameHeader.compressedSize) != Z_OK
+            || rawSize != frameHeader.rawSize)
+            return false;
+        int n = frameHeader.nbParticles;
+        bool keyframe = frames[f].keyframe;
+        const uint8_t* data = raw.data();
+        const uint8_t* end = data + raw.size();
+        if (n < 0
+            || !decodePlane(data, end, n, keyframe, current.x)
+            || !decodePlane(data, end, n, keyframe, current.y)
+            || !decodePlane(data, end, n, keyframe, current.orientation)
+            || !decodePlane(data, end, n, keyframe, current.spawnStep)
+            || end - data != n)
+            return false;
+        current.type.assign(data, end);
+        current.step = frameHeader.step;
+        currentFrame = f;
+    }
+    return true;
+}
+
+bool TrajectoryReader::read(int iFrame, RenderSnapshot& oSnapshot) {
+    if (iFrame < 0 || iFrame >= size() || !decode(iFrame))
+        return false;
+    int n = current.size();
+    oSnapshot.position.resize(n);
+    oSnapshot.orientation.resize(n);
+    oSnapshot.type.resize(n);
+    float orientationScale = 2.0f*M_PI/kOrientationUnits;
+    for (int i = 0; i < n; ++i) {
+        oSnapshot.position[i] = Vec2f(current.x[i]*header.quantum, current.y[i]*header.quantum);
+        oSnapshot.orientation[i] = current.orientation[i]*orientationScale;
+        oSnapshot.type[i] = (ParticleType)std::min<int>(current.type[i], ParticleType::L);
+    }
+    oSnapshot.spawnStep.assign(current.spawnStep.begin(), current.spawnStep.end());
+    oSnapshot.step = current.step;
+    oSnapshot.cells.clear();
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "MappedFile.h"
+#include "Model.h"
+#include "RenderSnapshot.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Recording of the particles every interval steps, for offline analysis and
+// replay. Native byte order, layout:
+//   TrajectoryHeader
+//   per frame: TrajectoryFrameHeader then its zlib compressed payload
+// The payload holds the quantised frame: positions in units of quantum and
+// orientations on 16 bits, each value minus the one of the same index in the
+// previous frame, zigzag varint encoded, one plane per field (x, y,
+// orientation, spawn step) then the types on one byte. Every keyframeInterval
+// frames a keyframe is coded against zeros so that replay can seek.
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t worldWidth;
+    int32_t worldHeight;
+    int32_t interval; // steps between frames
+    float quantum; // position unit
+    uint32_t keyframeInterval; // frames
+};
+
+struct TrajectoryFrameHeader {
+    uint32_t compressedSize;
+    uint32_t rawSize;
+    int32_t step;
+    int32_t nbParticles;
+    uint32_t keyframe;
+};
+
+// Quantised particles of a frame
+struct TrajectoryFrame {
+    int step = 0;
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<int32_t> orientation;
+    std::vector<int32_t> spawnStep;
+    std::vector<uint8_t> type;
+
+    int size() const {
+        return (int)x.size();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Streams frames to disk from the simulation thread. record() only quantises
+// the frame into a buffer, the encoding, compression and writing happen on
+// the recorder's I/O thread. When the I/O thread falls kMaxPending frames
+// behind the new frames are dropped rather than waiting for the disk.
+struct TrajectoryRecorder {
+    static const int kMaxPending = 8;
+    static const int kKeyframeInterval = 32;
+
+    std::atomic<int> nbFrames{0};
+    std::atomic<int> nbDropped{0};
+    std::atomic<long long> nbBytes{0};
+
+    ~TrajectoryRecorder() {
+        stop();
+    }
+
+    // Frames of iModel, position quantum in world units
+    bool start(const std::string& iPath, const Model& iModel, int iInterval, float iQuantum, std::string& oError);
+    // Writes the pending frames and closes the file
+    void stop();
+    // Set by a successful start() until stop(), readable from any thread
+    bool recording() const {
+        return active;
+    }
+    // Called after every step, records the frame when its step is due
+    void record(const Model& iModel);
+
+private:
+    void writerLoop();
+    void writeFrame(TrajectoryFrame& ioFrame);
+
+    std::atomic<bool> active{false};
+    int interval = 1;
+    float quantum = 1.0f;
+    std::ofstream file;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable pendingChanged;
+    std::deque<TrajectoryFrame> pending;
+    std::vector<TrajectoryFrame> freeFrames;
+    bool stopping = false;
+    // I/O thread state
+    TrajectoryFrame previous;
+    int frameIndex = 0;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> compressed;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Memory mapped recording. Frames are indexed when the file is opened, a
+// truncated last frame (recording interrupted) is ignored. Reading the frame
+// after the current one decodes a single delta, any other frame decodes from
+// the keyframe before it.
+struct TrajectoryReader {
+    TrajectoryHeader header;
+
+    bool open(const std::string& iPath, std::string& oError);
+    void close();
+    int size() const {
+        return (int)frames.size();
+    }
+    int frameStep(int iFrame) const {
+        return frames[iFrame].step;
+    }
+    bool read(int iFrame, RenderSnapshot& oSnapshot);
+
+private:
+    struct FrameIndex {
+        size_t offset; // of the frame header
+        int step;
+        bool keyframe;
+    };
+    bool decode(int iFrame);
+
+    MappedFile file;
+    std::vector<FrameIndex> frames;
+    TrajectoryFrame current;
+    int currentFrame = -1;
+    std::vector<uint8_t> raw;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+
+//////////////////////////////////////////////////////////////////////////////
+// Lock free single producer single consumer hand-off of the latest value:
+// the writer fills writeBuffer() then publish() swaps it with the middle slot,
+// the reader swaps the middle slot with its own when a new value is there.
+// Neither side ever waits, values the reader did not get to are dropped.
+template <typename T>
+struct TripleBuffer {
+    static const int kFresh = 4; // Set in middle when it holds an unread value
+    T buffers[3];
+    std::atomic<int> middle{1};
+    int back = 0; // Writer side
+    int front = 2; // Reader side
+
+    T& writeBuffer() {
+        return buffers[back];
+    }
+    void publish() {
+        back = middle.exchange(back | kFresh) & 3;
+    }
+    // Latest published value, the previous one when nothing new came
+    const T& read() {
+        if (middle.load() & kFresh)
+            front = middle.exchange(front) & 3;
+        return buffers[front];
+    }
+};
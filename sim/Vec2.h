@@ -0,0 +1,133 @@
+#pragma once
+#include <cmath>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// 2D vector of the model, same interface as sf::Vector2 so the simulation
+// does not depend on SFML
+template <typename T>
+struct Vec2 {
+    T x;
+    T y;
+
+    Vec2() : x(0), y(0) {}
+    Vec2(T iX, T iY) : x(iX), y(iY) {}
+    template <typename U>
+    explicit Vec2(const Vec2<U>& v) : x((T)v.x), y((T)v.y) {}
+
+    Vec2& operator+=(const Vec2& v) { x += v.x; y += v.y; return *this; }
+    Vec2& operator-=(const Vec2& v) { x -= v.x; y -= v.y; return *this; }
+    Vec2& operator*=(T s) { x *= s; y *= s; return *this; }
+    Vec2& operator/=(T s) { x /= s; y /= s; return *this; }
+};
+
+template <typename T> inline Vec2<T> operator-(const Vec2<T>& v) { return Vec2<T>(-v.x, -v.y); }
+template <typename T> inline Vec2<T> operator+(const Vec2<T>& a, const Vec2<T>& b) { return Vec2<T>(a.x+b.x, a.y+b.y); }
+template <typename T> inline Vec2<T> operator-(const Vec2<T>& a, const Vec2<T>& b) { return Vec2<T>(a.x-b.x, a.y-b.y); }
+template <typename T> inline Vec2<T> operator*(const Vec2<T>& v, T s) { return Vec2<T>(v.x*s, v.y*s); }
+template <typename T> inline Vec2<T> operator*(T s, const Vec2<T>& v) { return Vec2<T>(s*v.x, s*v.y); }
+template <typename T> inline Vec2<T> operator/(const Vec2<T>& v, T s) { return Vec2<T>(v.x/s, v.y/s); }
+template <typename T> inline bool operator==(const Vec2<T>& a, const Vec2<T>& b) { return a.x == b.x && a.y == b.y; }
+template <typename T> inline bool operator!=(const Vec2<T>& a, const Vec2<T>& b) { return !(a == b); }
+
+typedef Vec2<float> Vec2f;
+typedef Vec2<int> Vec2i;
+
+//////////////////////////////////////////////////////////////////////////////
+inline float angleFromVector(Vec2f v) {
+    return std::atan2(v.y, v.x);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+inline Vec2f unitVectorFromAngle(float iAngle) {
+    return Vec2f(std::cos(iAngle), std::sin(iAngle));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+inline Vec2f rotateVector(const Vec2f& v, float alpha) {
+    float cs = std::cos(alpha);
+    float sn = std::sin(alpha);
+
+    Vec2f rotatedVector;
+    rotatedVector.x = v.x * cs - v.y * sn;
+    rotatedVector.y = v.x * sn + v.y * cs;
+    return rotatedVector;
+}
+
+inline float dot(const Vec2f& v1, const Vec2f& v2) {
+    return v1.x * v2.x + v1.y * v2.y;
+}
+
+/*
+float colinearFactor(sf::Vector2f v1, sf::Vector2f v2) {
+    float dotProduct = v1.x * v2.x + v1.y * v2.y;
+    float lengthsProduct = std::sqrt(v1.x * v1.x + v1.y * v1.y) * std::sqrt(v2.x * v2.x + v2.y * v2.y);
+
+    // prevent division by zero
+    if(lengthsProduct == 0.f)
+        return 0.f;
+
+    float cosineOfAngle = dotProduct / lengthsProduct;
+
+    // Clamp the value to the [-1, 1] range, in case of numerical instability
+    cosineOfAngle = std::max(-1.f, std::min(1.f, cosineOfAngle));
+
+    return cosineOfAngle;
+}
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+inline float norm(const Vec2f& vec) {
+    return std::sqrt(vec.x * vec.x + vec.y * vec.y);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+inline void normalize(Vec2f& vec)
+{
+    float normVec = norm(vec);
+    if (!normVec == 0) vec /= normVec;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+inline double middleAngle(double theta1, double theta2) {
+    // Make sure theta1 and theta2 are in the range of [0, 2*PI]
+    theta1 = fmod(theta1, 2*M_PI);
+    if (theta1 < 0)
+        theta1 += 2*M_PI;
+
+    theta2 = fmod(theta2, 2*M_PI);
+    if (theta2 < 0)
+        theta2 += 2*M_PI;
+
+    // Compute difference
+    double diff = theta2 - theta1;
+    if (diff < -M_PI)
+        diff += 2*M_PI;
+    else if (diff > M_PI)
+        diff -= 2*M_PI;
+
+    // Compute middle angle
+    double middle = theta1 + diff / 2.0;
+
+    // Make sure the middle angle is in the range of [0, 2*PI]
+    middle = fmod(middle, 2*M_PI);
+    if (middle < 0)
+        middle += 2*M_PI;
+
+    return middle;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+inline float cross(const Vec2f& v1, const Vec2f& v2) {
+    return v1.x * v2.y - v1.y * v2.x;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Polynomial sin and cos for |iAngle| <= 1, error below 3e-6
+inline void smallAngleSinCos(float iAngle, float& oSin, float& oCos) {
+    float a2 = iAngle*iAngle;
+    oSin = iAngle*(1.0f + a2*(-1.0f/6.0f + a2*(1.0f/120.0f + a2*(-1.0f/5040.0f))));
+    oCos = 1.0f + a2*(-0.5f + a2*(1.0f/24.0f + a2*(-1.0f/720.0f + a2*(1.0f/40320.0f))));
+}
@@ -0,0 +1,75 @@
+#include "VerletLists.h"
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////
+bool VerletLists::update(const Plug& iPlug, const std::vector<Vec2f>& iPositions, float iRadius, float iSkin,
+                         ThreadPool& ioPool) {
+    bool stale = !valid || reference.size() != iPositions.size()
+                 || builtRadius != iRadius || builtSkin != iSkin
+                 || cells.sparse != iPlug.sparse || cells.gridNx != iPlug.gridNx || cells.gridNy != iPlug.gridNy
+                 || cells.stencilDx != iPlug.cellWidth || cells.stencilDy != iPlug.cellHeight;
+    if (!stale) {
+        // Largest displacement since the build, per tile then overall
+        tileDisplacement2.assign(iPlug.tileCount(), 0.0f);
+        ioPool.parallelFor(iPlug.tileCount(), [&](int t) {
+            float max2 = 0.0f;
+            for (int p : iPlug.getTile(t)) {
+                Vec2f d = iPositions[p] - reference[p];
+                max2 = std::max(max2, d.x*d.x + d.y*d.y);
+            }
+            tileDisplacement2[t] = max2;
+        });
+        float max2 = 0.0f;
+        for (float tileMax2 : tileDisplacement2)
+            max2 = std::max(max2, tileMax2);
+        float skin = std::max(0.0f, iSkin);
+        stale = max2 > 0.25f*skin*skin;
+    }
+    if (stale)
+        build(iPlug, iPositions, iRadius, iSkin, ioPool);
+    return stale;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Two passes over the half stencil of every particle: the list sizes, then the
+// lists at their final place, so that the build does not allocate once the
+// sizes are reached
+void VerletLists::build(const Plug& iPlug, const std::vector<Vec2f>& iPositions, float iRadius, float iSkin,
+                        ThreadPool& ioPool) {
+    int nbParticles = (int)iPositions.size();
+    float cutoff = iRadius + std::max(0.0f, iSkin);
+    float cutoff2 = cutoff*cutoff;
+    cells = iPlug;
+    cells.updateStencil(cutoff);
+    listStart.resize(nbParticles+1);
+    listStart[0] = 0;
+    // One grid row per task
+    ioPool.parallelFor(cells.tileCount(), [&](int t) {
+        cells.forEachInTile(t, [&](int p, int slot, int i, int j) {
+            int count = 0;
+            cells.forEachHalfNeighbour(slot, i, j, [&](int other) {
+                Vec2f r = iPositions[other] - iPositions[p];
+                count += r.x*r.x + r.y*r.y < cutoff2;
+            });
+            listStart[p+1] = count;
+        });
+    });
+    for (int p = 0; p < nbParticles; ++p)
+        listStart[p+1] += listStart[p];
+    neighbours.resize(listStart[nbParticles]);
+    ioPool.parallelFor(cells.tileCount(), [&](int t) {
+        cells.forEachInTile(t, [&](int p, int slot, int i, int j) {
+            int* cursor = neighbours.data()+listStart[p];
+            cells.forEachHalfNeighbour(slot, i, j, [&](int other) {
+                Vec2f r = iPositions[other] - iPositions[p];
+                if (r.x*r.x + r.y*r.y < cutoff2)
+                    *cursor++ = other;
+            });
+        });
+    });
+    reference.assign(iPositions.begin(), iPositions.end());
+    builtRadius = iRadius;
+    builtSkin = iSkin;
+    valid = true;
+    ++nbBuilds;
+}
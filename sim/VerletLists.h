@@ -0,0 +1,43 @@
+#pragma once
+#include "Plug.h"
+#include "ThreadPool.h"
+#include "Vec2.h"
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Verlet neighbour lists: the pairs closer than the interaction radius + the
+// skin at the last build. While no particle has moved by more than
+// skin/2 since the build, every pair within the interaction radius is in the
+// lists, so they are reused across steps instead of walking the grid cells.
+// The lists follow the half stencil of a copy of the plug taken at the build
+// with the stencil widened to the cutoff: each pair is in one list only, and
+// the half tiles of that copy keep the writes of the force phase apart.
+// The lists are indexed by particle: adding or removing particles
+// invalidates them.
+struct VerletLists {
+    Plug cells; // Plug at the last build
+    std::vector<int> listStart; // list of p is neighbours[listStart[p]] to neighbours[listStart[p+1]-1]
+    std::vector<int> neighbours;
+    std::vector<Vec2f> reference; // Positions at the last build
+    std::vector<float> tileDisplacement2;
+    float builtRadius = -1.0f;
+    float builtSkin = -1.0f;
+    bool valid = false;
+    long long nbBuilds = 0;
+
+    void invalidate() {
+        valid = false;
+    }
+    // Builds the lists again from the plug when they may miss a pair within
+    // iRadius, true when they were rebuilt
+    bool update(const Plug& iPlug, const std::vector<Vec2f>& iPositions, float iRadius, float iSkin,
+                ThreadPool& ioPool);
+    void build(const Plug& iPlug, const std::vector<Vec2f>& iPositions, float iRadius, float iSkin,
+               ThreadPool& ioPool);
+    template<typename Function>
+    void forEachNeighbour(int p, Function f) const {
+        const int* data = neighbours.data();
+        for (const int* it = data+listStart[p]; it != data+listStart[p+1]; ++it)
+            f(*it);
+    }
+};
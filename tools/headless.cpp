@@ -0,0 +1,181 @@
+#include "Checkpoint.h"
+#include "Model.h"
+#include "Profiler.h"
+#include "Scenario.h"
+#include "Trajectory.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs a scenario without display as fast as possible and reports the throughput
+//   particlelife_headless [scenario] [--load checkpoint] [--save checkpoint] [--steps N]
+//                         [--threads N] [--seed N] [--set name=value]... [--profile] [--trace N file]
+//                         [--record file interval] [--clusters interval]
+// With --load the run starts from the checkpoint instead of the scenario
+// population, the settings of the scenario and of the command line apply on
+// top of it. The emitters of the scenario are only added when the checkpoint
+// has none, a run resumed with its scenario goes on as if uninterrupted.
+// --save writes the final state. Runs with the same seed and settings give the
+// same particles whatever the thread count.
+// --record writes a frame every interval steps, for replay in the GUI app.
+// --clusters analyses the S clusters every interval steps (cluster_interval),
+// prints each division when it is found and the clusters of the last analysis,
+// the closed rings marked with a *.
+static void printUsage() {
+    std::cerr << "usage: particlelife_headless [scenario] [--load checkpoint] [--save checkpoint] [--steps N]"
+                 " [--threads N] [--seed N] [--set name=value]... [--profile] [--trace N file] [--record file interval]"
+                 " [--clusters interval]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+    Scenario scenario;
+    std::string error;
+    int first = 1;
+    if (argv[1][0] != '-') {
+        if (!scenario.load(argv[1], error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        first = 2;
+    }
+    std::string loadPath;
+    std::string savePath;
+    std::string recordPath;
+    int recordInterval = 1;
+    // Command line overrides come after the scenario settings
+    for (int i = first; i < argc; ++i) {
+        bool hasValue = i+1 < argc;
+        if (!std::strcmp(argv[i], "--load") && hasValue) {
+            loadPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--save") && hasValue) {
+            savePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--record") && i+2 < argc) {
+            recordPath = argv[++i];
+            recordInterval = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--steps") && hasValue) {
+            scenario.steps = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+            scenario.settings.push_back(Scenario::Setting{findParam("nb_threads"), argv[++i]});
+        } else if (!std::strcmp(argv[i], "--clusters") && hasValue) {
+            scenario.settings.push_back(Scenario::Setting{findParam("cluster_interval"), argv[++i]});
+        } else if (!std::strcmp(argv[i], "--seed") && hasValue) {
+            scenario.settings.push_back(Scenario::Setting{findParam("seed"), argv[++i]});
+        } else if (!std::strcmp(argv[i], "--profile")) {
+            g_profiler.enabled = true;
+        } else if (!std::strcmp(argv[i], "--trace") && i+2 < argc) {
+            int nbFrames = std::atoi(argv[++i]);
+            g_profiler.startTrace(nbFrames, argv[++i]);
+        } else if (!std::strcmp(argv[i], "--set") && hasValue) {
+            std::string assignment = argv[++i];
+            std::string::size_type equal = assignment.find('=');
+            Param* param = equal == std::string::npos ? nullptr : findParam(assignment.substr(0, equal));
+            alignas(8) char scratch[8];
+            if (!param || !param->parse(assignment.substr(equal+1), scratch)) {
+                std::cerr << "invalid setting " << assignment << std::endl;
+                return 1;
+            }
+            scenario.settings.push_back(Scenario::Setting{param, assignment.substr(equal+1)});
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (first == 1 && loadPath.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    Model model;
+    if (loadPath.empty()) {
+        scenario.apply(model);
+    } else {
+        if (!loadCheckpoint(loadPath, model, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        if (scenario.name.empty())
+            scenario.name = loadPath;
+        scenario.applySettings(model);
+        if (model.emitters.empty())
+            model.emitters = scenario.getEmitters(model.config);
+    }
+    TrajectoryRecorder recorder;
+    if (!recordPath.empty() && !recorder.start(recordPath, model, recordInterval, DOT_SIZE/100.0f, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    int initialStep = model._step;
+    int initialPopulation = model.particles.size();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // A step is a profiler frame
+    int nbDivisions = 0;
+    for (int i = 0; i < scenario.steps; ++i) {
+        model.step();
+        recorder.record(model);
+        const ClusterTracker& clusters = model.clusters;
+        if (clusters.nbDivisions != nbDivisions) {
+            int nbNew = std::min(clusters.nbDivisions-nbDivisions, (int)clusters.divisions.size());
+            for (int d = (int)clusters.divisions.size()-nbNew; d < (int)clusters.divisions.size(); ++d) {
+                const ClusterDivision& division = clusters.divisions[d];
+                std::cout << "division   step " << division.step << ", cluster " << division.parent << " -> " << division.child
+                          << " (" << division.parentSize << " + " << division.childSize << " S)" << std::endl;
+            }
+            nbDivisions = clusters.nbDivisions;
+        }
+        g_profiler.endFrame();
+    }
+    recorder.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!savePath.empty()) {
+        if (!saveCheckpoint(savePath, model, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "scenario   " << scenario.name << std::endl;
+    std::cout << "threads    " << std::max(1, model.config.nb_threads) << std::endl;
+    std::cout << "seed       " << model.config.seed << std::endl;
+    std::cout << "population " << initialPopulation << " -> " << model.particles.size() << std::endl;
+    std::cout << "steps      " << initialStep << " -> " << model._step << std::endl;
+    std::cout << "seconds    " << seconds << std::endl;
+    std::cout << "steps/s    " << (seconds > 0.0 ? scenario.steps/seconds : 0.0) << std::endl;
+    std::cout << "grid       " << model.plug.nbCellsX << "x" << model.plug.nbCellsY << ", " << model.plug.averageCandidates()
+              << " candidates per particle" << std::endl;
+    if (model.config.verlet_lists)
+        std::cout << "neighbour builds " << model.verletLists.nbBuilds << std::endl;
+    if (model.clusters.step >= 0) {
+        const ClusterTracker& clusters = model.clusters;
+        std::cout << "clusters   " << clusters.clusters.size() << " at step " << clusters.step << ", "
+                  << clusters.nbClosed << " closed rings, " << clusters.nbDivisions << " divisions" << std::endl;
+        std::cout << "sizes     ";
+        for (const TrackedCluster& cluster : clusters.clusters)
+            std::cout << " " << cluster.size << (cluster.closed() ? "*" : "");
+        std::cout << std::endl;
+    }
+    if (!recordPath.empty()) {
+        std::cout << "recorded   " << recorder.nbFrames << " frames, " << recorder.nbBytes << " bytes, "
+                  << recorder.nbDropped << " dropped" << std::endl;
+    }
+    if (g_profiler.enabled) {
+        // Means over the last Profiler::kHistory steps
+        for (int k = 0; k < Profiler::kNbPhases; ++k)
+            if (g_profiler.meanTime(k) > 0.0f)
+                std::cout << Profiler::phaseName(k) << " " << g_profiler.meanTime(k) << " ms" << std::endl;
+        for (int k = 0; k < Profiler::kNbCounters; ++k)
+            std::cout << Profiler::counterName(k) << " " << g_profiler.meanCount(k) << std::endl;
+        if (!g_profiler.traceStatus.empty())
+            std::cout << g_profiler.traceStatus << std::endl;
+    }
+    return 0;
+}
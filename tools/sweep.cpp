@@ -0,0 +1,83 @@
+#include "Params.h"
+#include "Sweep.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+//////////////////////////////////////////////////////////////////////////////
+// Runs a parameter sweep without display, one CSV line of results per run
+//   particlelife_sweep <sweep> [--out file] [--workers N] [--steps N] [--list]
+// The sweep file format is described in sim/Sweep.h. The lines go to the
+// standard output without --out, the progress to the standard error.
+// --workers sets the runs made at the same time, all the cores by default.
+// --list prints the settings of every run without running them.
+static void printUsage() {
+    std::cerr << "usage: particlelife_sweep <sweep> [--out file] [--workers N] [--steps N] [--list]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage();
+        return 1;
+    }
+    Sweep sweep;
+    std::string error;
+    if (!sweep.load(argv[1], error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::string outPath;
+    int nbWorkers = defaultThreadCount();
+    bool list = false;
+    for (int i = 2; i < argc; ++i) {
+        bool hasValue = i+1 < argc;
+        if (!std::strcmp(argv[i], "--out") && hasValue) {
+            outPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--workers") && hasValue) {
+            nbWorkers = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--steps") && hasValue) {
+            sweep.steps = std::max(0, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--list")) {
+            list = true;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    int nbRuns = sweep.runCount();
+    if (list) {
+        std::vector<std::vector<std::string>> samples = sweep.getSamples();
+        for (int r = 0; r < nbRuns; ++r) {
+            Scenario scenario = sweep.getRunScenario(r, samples);
+            std::cout << r;
+            for (const Scenario::Setting& setting : scenario.settings)
+                std::cout << " " << setting.param->name << "=" << setting.value;
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath, std::ios::trunc);
+        if (!file) {
+            std::cerr << "cannot write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::cerr << sweep.name << ": " << nbRuns << " runs on " << nbWorkers << " workers" << std::endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int nbDone = 0;
+    runSweep(sweep, nbWorkers, outPath.empty() ? std::cout : file, [&](const SweepResult& iResult) {
+        ++nbDone;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "run " << iResult.run << " done in " << iResult.seconds << " s, "
+                  << nbDone << "/" << nbRuns << " after " << seconds << " s" << std::endl;
+    });
+    return 0;
+}